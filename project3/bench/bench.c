@@ -0,0 +1,426 @@
+/*
+ * Throughput benchmark for cachesim.
+ *
+ * Generates synthetic traces in the binary trace format, then runs the
+ * cachesim binary on every (configuration, trace) pair and measures the
+ * wall time and peak RSS of each run. Results go to stdout as a table
+ * and, with -o, to a CSV file for comparing builds.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "trace.h"
+
+#define TRUE 1
+#define FALSE 0
+
+// Records buffered between writes of a generated trace
+#define GEN_BATCH 8192
+// Base address of every generated access pattern
+#define GEN_BASE 0x10000000ULL
+// Zipf exponent of the zipf pattern
+#define ZIPF_S 0.99
+// One in this many generated data accesses is a write
+#define WRITE_RATIO 4
+
+typedef struct bench_options {
+    uint64_t accesses;          // Accesses per generated trace
+    uint64_t footprint_bits;    // Each pattern touches 2^footprint_bits bytes
+    uint64_t stride;            // Bytes between accesses of the strided pattern
+    unsigned repeats;           // Runs per point; the fastest is reported
+    const char* dir;            // Where the traces are generated
+} bench_options_t;
+
+typedef struct generator {
+    const char* name;
+    void (*generate)(const bench_options_t* options, uint64_t* seed,
+                     uint64_t* records, size_t n, uint64_t* state);
+} generator_t;
+
+/**
+ * xorshift64* step
+ */
+static uint64_t next_random(uint64_t* seed)
+{
+    uint64_t x = *seed;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *seed = x;
+    return x * 0x2545f4914f6cdd1dULL;
+}
+
+static uint64_t random_below(uint64_t* seed, uint64_t bound)
+{
+    return next_random(seed) % bound;
+}
+
+static char random_rw(uint64_t* seed)
+{
+    return random_below(seed, WRITE_RATIO) == 0 ? 'w' : 'r';
+}
+
+/*
+ * Each generator fills records with the next n accesses of its pattern.
+ * state carries the pattern's position from one call to the next and
+ * starts at 0.
+ */
+
+static void gen_sequential(const bench_options_t* options, uint64_t* seed,
+                           uint64_t* records, size_t n, uint64_t* state)
+{
+    uint64_t mask = ((uint64_t) 1 << options->footprint_bits) - 1;
+    for (size_t i = 0; i < n; i++) {
+        records[i] = trace_pack(random_rw(seed), GEN_BASE + (*state & mask));
+        *state += sizeof(uint64_t);
+    }
+}
+
+static void gen_strided(const bench_options_t* options, uint64_t* seed,
+                        uint64_t* records, size_t n, uint64_t* state)
+{
+    uint64_t mask = ((uint64_t) 1 << options->footprint_bits) - 1;
+    for (size_t i = 0; i < n; i++) {
+        records[i] = trace_pack(random_rw(seed), GEN_BASE + (*state & mask));
+        *state += options->stride;
+    }
+}
+
+static void gen_random(const bench_options_t* options, uint64_t* seed,
+                       uint64_t* records, size_t n, uint64_t* state)
+{
+    (void) state;
+    uint64_t words = ((uint64_t) 1 << options->footprint_bits) / sizeof(uint64_t);
+    for (size_t i = 0; i < n; i++) {
+        uint64_t address = GEN_BASE + random_below(seed, words) * sizeof(uint64_t);
+        records[i] = trace_pack(random_rw(seed), address);
+    }
+}
+
+/*
+ * The zipf and pointer-chase patterns need a table over the blocks of
+ * the footprint, built on first use
+ */
+static double* zipf_cdf;
+static uint64_t* chase_next;
+
+static uint64_t num_blocks(const bench_options_t* options)
+{
+    return ((uint64_t) 1 << options->footprint_bits) / 64;
+}
+
+static void gen_zipf(const bench_options_t* options, uint64_t* seed,
+                     uint64_t* records, size_t n, uint64_t* state)
+{
+    (void) state;
+    uint64_t blocks = num_blocks(options);
+    if (!zipf_cdf) {
+        zipf_cdf = malloc(blocks * sizeof(double));
+        if (!zipf_cdf) {
+            printf("Out of memory\n");
+            exit(1);
+        }
+        double total = 0.0;
+        for (uint64_t k = 0; k < blocks; k++) {
+            total += 1.0 / pow((double) (k + 1), ZIPF_S);
+            zipf_cdf[k] = total;
+        }
+        for (uint64_t k = 0; k < blocks; k++) {
+            zipf_cdf[k] /= total;
+        }
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        double u = (double) (next_random(seed) >> 11) / (double) (1ULL << 53);
+        uint64_t lo = 0, hi = blocks - 1;
+        while (lo < hi) {
+            uint64_t mid = (lo + hi) / 2;
+            if (zipf_cdf[mid] < u) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        // Scatter the ranks over the footprint (an odd multiplier permutes them)
+        uint64_t block = (lo * 0x9e3779b97f4a7c15ULL) & (blocks - 1);
+        records[i] = trace_pack(random_rw(seed), GEN_BASE + block * 64);
+    }
+}
+
+static void gen_chase(const bench_options_t* options, uint64_t* seed,
+                      uint64_t* records, size_t n, uint64_t* state)
+{
+    uint64_t blocks = num_blocks(options);
+    if (!chase_next) {
+        // Sattolo's algorithm: a random permutation that is a single cycle
+        chase_next = malloc(blocks * sizeof(uint64_t));
+        if (!chase_next) {
+            printf("Out of memory\n");
+            exit(1);
+        }
+        for (uint64_t k = 0; k < blocks; k++) {
+            chase_next[k] = k;
+        }
+        for (uint64_t k = blocks - 1; k > 0; k--) {
+            uint64_t j = random_below(seed, k);
+            uint64_t tmp = chase_next[k];
+            chase_next[k] = chase_next[j];
+            chase_next[j] = tmp;
+        }
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        *state = chase_next[*state];
+        records[i] = trace_pack('r', GEN_BASE + *state * 64);
+    }
+}
+
+static const generator_t generators[] = {
+    { "sequential", gen_sequential },
+    { "strided", gen_strided },
+    { "random", gen_random },
+    { "zipf", gen_zipf },
+    { "chase", gen_chase },
+};
+
+#define NUM_GENERATORS (sizeof(generators) / sizeof(generators[0]))
+
+/**
+ * Writes options->accesses accesses of a pattern to a binary trace
+ *
+ * @return 0 on success, -1 on failure
+ */
+static int generate_trace(const bench_options_t* options, const generator_t* gen,
+                          const char* path)
+{
+    FILE* fout = fopen(path, "wb");
+    if (!fout) return -1;
+
+    trace_header_t header;
+    memcpy(header.magic, TRACE_MAGIC, TRACE_MAGIC_LEN);
+    header.count = options->accesses;
+    int ret = fwrite(&header, sizeof(header), 1, fout) == 1 ? 0 : -1;
+
+    static uint64_t records[GEN_BATCH];
+    uint64_t seed = 0x853c49e6748fea9bULL;
+    uint64_t state = 0;
+    for (uint64_t done = 0; ret == 0 && done < options->accesses; ) {
+        size_t n = options->accesses - done < GEN_BATCH ? (size_t) (options->accesses - done) : GEN_BATCH;
+        gen->generate(options, &seed, records, n, &state);
+        if (fwrite(records, sizeof(uint64_t), n, fout) != n) ret = -1;
+        done += n;
+    }
+    if (fclose(fout)) ret = -1;
+    return ret;
+}
+
+/**
+ * Generates every trace in a child process. Linux carries a process's
+ * peak RSS over fork and exec, so memory the generators touched in this
+ * process would be reported as part of every cachesim run.
+ *
+ * @return 0 on success, -1 on failure
+ */
+static int generate_traces(const bench_options_t* options, char paths[][256])
+{
+    fflush(NULL);
+    pid_t child = fork();
+    if (child < 0) return -1;
+    if (child == 0) {
+        int ret = 0;
+        for (unsigned g = 0; g < NUM_GENERATORS && ret == 0; g++) {
+            if ((ret = generate_trace(options, &generators[g], paths[g]))) {
+                perror(paths[g]);
+            }
+        }
+        free(zipf_cdf);
+        free(chase_next);
+        fflush(NULL);
+        _exit(ret ? 1 : 0);
+    }
+
+    int status;
+    if (waitpid(child, &status, 0) != child) return -1;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+/**
+ * Runs cachesim once with stdout discarded
+ *
+ * @param seconds Set to the wall time of the run
+ * @param max_rss_kb Set to the peak resident set size of the run
+ * @return 0 if cachesim ran and exited successfully, -1 otherwise
+ */
+static int time_run(char* const* argv, double* seconds, long* max_rss_kb)
+{
+    struct timespec start, end;
+    fflush(NULL);   // Or the child would write out our buffered output too
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    pid_t child = fork();
+    if (child < 0) return -1;
+    if (child == 0) {
+        if (!freopen("/dev/null", "w", stdout)) _exit(127);
+        execv(argv[0], argv);
+        perror(argv[0]);
+        _exit(127);
+    }
+
+    int status;
+    struct rusage usage;
+    if (wait4(child, &status, 0, &usage) != child) return -1;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    *seconds = (double) (end.tv_sec - start.tv_sec) + (double) (end.tv_nsec - start.tv_nsec) / 1e9;
+    *max_rss_kb = usage.ru_maxrss;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+static void print_help_and_exit(void)
+{
+    printf("bench [OPTIONS] path/to/cachesim\n");
+    printf("  -x\t\tFile of \"C B S policy\" lines to time (defaults to bench/bench.cfg)\n");
+    printf("  -n\t\tAccesses per generated trace (defaults to 4000000)\n");
+    printf("  -f\t\tEach trace touches 2^f bytes (defaults to 24)\n");
+    printf("  -s\t\tBytes between accesses of the strided trace (defaults to 4160)\n");
+    printf("  -R\t\tRuns per point, of which the fastest is reported (defaults to 3)\n");
+    printf("  -d\t\tDirectory the traces are generated in (defaults to bench/traces)\n");
+    printf("  -o\t\tAlso write the results as CSV to the given file\n");
+    printf("  -h\t\tThis helpful output\n");
+    exit(0);
+}
+
+int main(int argc, char* argv[])
+{
+    bench_options_t options;
+    options.accesses = 4000000;
+    options.footprint_bits = 24;
+    options.stride = 4160;
+    options.repeats = 3;
+    options.dir = "bench/traces";
+    const char* config_path = "bench/bench.cfg";
+    const char* csv_path = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "x:n:f:s:R:d:o:h")) != -1) {
+        switch (opt) {
+            case 'x':
+                config_path = optarg;
+                break;
+            case 'n':
+                options.accesses = strtoull(optarg, NULL, 0);
+                break;
+            case 'f':
+                options.footprint_bits = strtoull(optarg, NULL, 0);
+                break;
+            case 's':
+                options.stride = strtoull(optarg, NULL, 0);
+                break;
+            case 'R':
+                options.repeats = (unsigned) strtoul(optarg, NULL, 0);
+                break;
+            case 'd':
+                options.dir = optarg;
+                break;
+            case 'o':
+                csv_path = optarg;
+                break;
+            case 'h':
+            default:
+                print_help_and_exit();
+                break;
+        }
+    }
+    if (optind != argc - 1 || options.footprint_bits < 6 || options.footprint_bits > 40
+            || options.repeats == 0) {
+        print_help_and_exit();
+    }
+    char* cachesim = argv[optind];
+
+    FILE* fconfig = fopen(config_path, "r");
+    if (!fconfig) {
+        perror("Unable to open configuration list");
+        exit(1);
+    }
+    FILE* fcsv = NULL;
+    if (csv_path && !(fcsv = fopen(csv_path, "w"))) {
+        perror("Unable to open results file");
+        exit(1);
+    }
+    if (mkdir(options.dir, 0755) && errno != EEXIST) {
+        perror("Unable to create trace directory");
+        exit(1);
+    }
+
+    char paths[NUM_GENERATORS][256];
+    for (unsigned g = 0; g < NUM_GENERATORS; g++) {
+        snprintf(paths[g], sizeof(paths[g]), "%s/%s-%" PRIu64 ".bin",
+                 options.dir, generators[g].name, options.accesses);
+    }
+    if (generate_traces(&options, paths)) {
+        printf("Unable to generate the traces\n");
+        exit(1);
+    }
+
+    printf("%-12s %3s %3s %3s %-7s %14s %10s %10s\n",
+           "trace", "C", "B", "S", "policy", "accesses/s", "ns/access", "RSS (KB)");
+    if (fcsv) {
+        fprintf(fcsv, "trace,C,B,S,policy,accesses,seconds,accesses_per_sec,ns_per_access,max_rss_kb\n");
+    }
+
+    // execv wants mutable strings
+    char flag_c[] = "-C", flag_b[] = "-B", flag_s[] = "-S", flag_r[] = "-r", flag_i[] = "-i";
+    char line[256];
+    int failed = FALSE;
+    while (fgets(line, sizeof(line), fconfig)) {
+        char* comment = strchr(line, '#');
+        if (comment) *comment = '\0';
+        char c[8], b[8], s[8], policy[16];
+        if (sscanf(line, "%7s %7s %7s %15s", c, b, s, policy) != 4) continue;
+
+        for (unsigned g = 0; g < NUM_GENERATORS; g++) {
+            char* run_argv[] = { cachesim, flag_c, c, flag_b, b, flag_s, s,
+                                 flag_r, policy, flag_i, paths[g], NULL };
+            double best = 0.0;
+            long rss = 0;
+            int ok = TRUE;
+            for (unsigned r = 0; r < options.repeats; r++) {
+                double seconds;
+                long max_rss_kb;
+                if (time_run(run_argv, &seconds, &max_rss_kb)) {
+                    printf("cachesim failed on %s with C=%s B=%s S=%s %s\n",
+                           generators[g].name, c, b, s, policy);
+                    failed = TRUE;
+                    ok = FALSE;
+                    break;
+                }
+                if (r == 0 || seconds < best) best = seconds;
+                if (max_rss_kb > rss) rss = max_rss_kb;
+            }
+            // A failed configuration has no timing to report
+            if (!ok) continue;
+
+            double rate = (double) options.accesses / best;
+            double ns = best * 1e9 / (double) options.accesses;
+            printf("%-12s %3s %3s %3s %-7s %14.0f %10.2f %10ld\n",
+                   generators[g].name, c, b, s, policy, rate, ns, rss);
+            if (fcsv) {
+                fprintf(fcsv, "%s,%s,%s,%s,%s,%" PRIu64 ",%f,%.0f,%.3f,%ld\n",
+                        generators[g].name, c, b, s, policy, options.accesses, best, rate, ns, rss);
+            }
+        }
+    }
+    fclose(fconfig);
+    if (fcsv && fclose(fcsv)) {
+        perror("Unable to write results file");
+        failed = TRUE;
+    }
+    return failed ? 1 : 0;
+}
@@ -1,25 +1,43 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
 #include "cachesim.h"
+#include "policy.h"
 
 #define TRUE 1
 #define FALSE 0
 
-/**
- * The stuct that you may use to store the metadata for each block in
- * the cache
- */
-typedef struct block {
-    uint64_t tag;  // The tag stored in that block
-    uint8_t valid; // Valid bit
-    uint8_t dirty; // Dirty bit
+// Accesses whose tags and indices are computed together in a batch
+#define BATCH_CHUNK 64
+// How many accesses ahead a batch prefetches sets
+#define BATCH_PREFETCH 8
+// Addresses per vector in split_addresses
+#define BATCH_VECTOR 4
 
-    // Add any metadata here to perform LRU/FIFO replacement. For LRU,
-    // think about how you could use a counter variable to track the
-    // oldest block in a set. For FIFO, consider how you would
-    // implement a queue with only a single pointer.
+typedef uint64_t vec_u64_t __attribute__((vector_size(BATCH_VECTOR * sizeof(uint64_t))));
 
-    // TODO
-
-} block_t;
+// Sets with fewer ways than this are searched with a plain loop
+#define SIMD_MIN_WAYS 4
+// Alignment of the tag array, one AVX2 vector
+#define TAG_ALIGN 32
+// Tag stored in invalid ways; no real tag can have every bit set
+#define INVALID_TAG UINT64_MAX
+// Largest supported associativity, bounded by the policies' 16-bit way numbers
+#define MAX_S 16
+// Largest supported number of blocks is 2^MAX_BLOCKS, which keeps every
+// size in a cache's layout well inside size_t
+#define MAX_BLOCKS 40
+// Identifies cache checkpoint files
+#define CHECKPOINT_MAGIC "CSIMCKP1"
+// Offset of the cache image in a checkpoint, page aligned so it can be mapped in place
+#define CHECKPOINT_IMAGE_OFFSET 4096
 
 /**
  * A struct for storing the configuration of the cache as passed in
@@ -32,28 +50,872 @@ typedef struct config {
     enum REPLACEMENT_POLICY policy;
 } config_t;
 
-// You may add global variables, structs, and function headers below
-// this line if you need any
+/**
+ * Returns the first way of a set holding tag, or ways if there is none
+ */
+typedef uint64_t (*find_way_t)(const uint64_t* tags, uint64_t ways, uint64_t tag);
+
+/**
+ * A cache_access_batch_h specialized for one configuration
+ */
+typedef void (*batch_kernel_t)(cache_t* cache, const char* rw, const uint64_t* addresses,
+                               size_t n, uint8_t* hits, cache_stats_t* stats);
+
+/**
+ * One simulated cache. All of the simulation state lives here so that
+ * any number of caches can be simulated side by side.
+ *
+ * Block metadata is kept as a structure of arrays: a tag array searched
+ * by find_way, per-set valid and dirty bitmaps of words_per_set 64-bit
+ * words each, stored next to each other so that both usually share a
+ * host cache line, and the replacement policy's own state. The struct
+ * and all of its arrays share a single allocation.
+ *
+ * A separate per-set bitmap marks blocks that were prefetched and not
+ * yet used. It is only kept up to date once cache_prefetch_h has been
+ * called, so caches without a prefetcher never touch it.
+ */
+struct cache {
+    config_t config;
+
+    uint64_t* tags;         // num_sets * ways tags, aligned to TAG_ALIGN
+    uint64_t* flags;        // Per set, words_per_set valid then dirty words
+    uint64_t* prefetched;   // Per set, words_per_set prefetched-but-unused words
+    uint8_t track_prefetch;
+    const policy_t* policy;
+    void* policy_state;
+    uint64_t num_sets;
+    uint64_t ways;
+    uint64_t words_per_set;
+
+    // get_tag and get_index, precomputed for this configuration
+    uint64_t tag_shift;
+    uint64_t index_shift;
+    uint64_t index_mask;
+
+    find_way_t find_way;    // Tag search used for sets of SIMD_MIN_WAYS or more
+    batch_kernel_t kernel;  // Specialized batch simulation, or NULL for the generic one
+
+    size_t size;            // Bytes in the allocation, struct included
+    void* mapping;          // Checkpoint mapping holding the cache, or NULL
+    size_t mapping_size;
+};
+
+// The cache used by cache_init, cache_access and cache_cleanup
+static cache_t* default_cache;
+
+static uint64_t find_way_scalar(const uint64_t* tags, uint64_t ways, uint64_t tag)
+{
+    uint64_t i = 0;
+    while (i < ways && tags[i] != tag) i++;
+    return i;
+}
+
+#ifdef HAVE_X86_SIMD
+/**
+ * Compares four tags per instruction. ways must be a multiple of 4 and
+ * tags aligned to 32 bytes.
+ */
+__attribute__((target("avx2")))
+static uint64_t find_way_avx2(const uint64_t* tags, uint64_t ways, uint64_t tag)
+{
+    __m256i needle = _mm256_set1_epi64x((long long) tag);
+    for (uint64_t i = 0; i < ways; i += 4) {
+        __m256i row = _mm256_load_si256((const __m256i*) (const void*) &tags[i]);
+        int mask = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(row, needle)));
+        if (mask) return i + (uint64_t) __builtin_ctz((unsigned) mask);
+    }
+    return ways;
+}
+
+/**
+ * Compares two tags per instruction. ways must be a multiple of 4 and
+ * tags aligned to 16 bytes.
+ */
+__attribute__((target("sse4.1")))
+static uint64_t find_way_sse41(const uint64_t* tags, uint64_t ways, uint64_t tag)
+{
+    __m128i needle = _mm_set1_epi64x((long long) tag);
+    for (uint64_t i = 0; i < ways; i += 4) {
+        __m128i lo = _mm_cmpeq_epi64(_mm_load_si128((const __m128i*) (const void*) &tags[i]), needle);
+        __m128i hi = _mm_cmpeq_epi64(_mm_load_si128((const __m128i*) (const void*) &tags[i + 2]), needle);
+        int mask = _mm_movemask_pd(_mm_castsi128_pd(lo))
+            | (_mm_movemask_pd(_mm_castsi128_pd(hi)) << 2);
+        if (mask) return i + (uint64_t) __builtin_ctz((unsigned) mask);
+    }
+    return ways;
+}
+#endif
+
+/**
+ * Picks the fastest tag search the host CPU supports
+ */
+static find_way_t select_find_way(void)
+{
+#ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return find_way_avx2;
+    if (__builtin_cpu_supports("sse4.1")) return find_way_sse41;
+#endif
+    return find_way_scalar;
+}
+
+/**
+ * Rounds a size up to a multiple of TAG_ALIGN
+ */
+static size_t align_size(size_t size)
+{
+    return (size + TAG_ALIGN - 1) & ~(size_t) (TAG_ALIGN - 1);
+}
+
+/**
+ * Byte sizes of the pieces of a cache's single allocation
+ */
+typedef struct cache_layout {
+    size_t tags;
+    size_t flags;
+    size_t prefetched;
+    size_t policy;
+    size_t total;
+} cache_layout_t;
+
+/**
+ * Checks a configuration and works out the layout of its allocation
+ *
+ * @return The policy implementation, or NULL if the configuration is invalid
+ */
+static const policy_t* cache_plan(uint64_t C, uint64_t B, uint64_t S,
+                                  enum REPLACEMENT_POLICY policy, cache_layout_t* layout)
+{
+    const policy_t* impl = policy_get(policy);
+    if (!impl || C >= 64 || C < B + S || S > MAX_S || C - B > MAX_BLOCKS
+            || ((uint64_t) 1 << (C - B)) > SIZE_MAX / 64) {
+        return NULL;
+    }
+
+    uint64_t num_sets = (uint64_t) 1 << (C - B - S);
+    uint64_t ways = (uint64_t) 1 << S;
+    uint64_t words_per_set = (ways + 63) / 64;
+    layout->tags = align_size(num_sets * ways * sizeof(uint64_t));
+    layout->flags = align_size(num_sets * 2 * words_per_set * sizeof(uint64_t));
+    layout->prefetched = align_size(num_sets * words_per_set * sizeof(uint64_t));
+    layout->policy = align_size(impl->state_size(num_sets, ways));
+    layout->total = align_size(sizeof(cache_t)) + layout->tags + layout->flags
+        + layout->prefetched + layout->policy;
+    return impl;
+}
+
+static batch_kernel_t select_kernel(const config_t* config);
+
+/**
+ * Points a cache's arrays into the memory that follows the struct and
+ * fills in everything derived from its configuration. Leaves the
+ * contents of the arrays alone.
+ */
+static void cache_bind(cache_t* cache, const policy_t* impl, const cache_layout_t* layout)
+{
+    uint64_t C = cache->config.C;
+    uint64_t B = cache->config.B;
+    uint64_t S = cache->config.S;
+
+    char* next = (char*) cache + align_size(sizeof(cache_t));
+    cache->tags = (uint64_t*) (void*) next;
+    next += layout->tags;
+    cache->flags = (uint64_t*) (void*) next;
+    next += layout->flags;
+    cache->prefetched = (uint64_t*) (void*) next;
+    next += layout->prefetched;
+    cache->policy = impl;
+    cache->policy_state = next;
+
+    cache->num_sets = (uint64_t) 1 << (C - B - S);
+    cache->ways = (uint64_t) 1 << S;
+    cache->words_per_set = (cache->ways + 63) / 64;
+    cache->tag_shift = C - S;
+    cache->index_shift = B;
+    cache->index_mask = cache->num_sets - 1;
+    cache->find_way = select_find_way();
+    cache->kernel = select_kernel(&cache->config);
+    cache->size = layout->total;
+}
+
+/**
+ * Creates a cache with the passed in arguments.
+ *
+ * @param C The total size of the cache is 2^C bytes
+ * @param B The size of the blocks is 2^B bytes
+ * @param S The total number of blocks in a line/set of the cache are 2^S
+ * @param policy The replacement policy of the cache
+ * @return The new cache, or NULL if the parameters are invalid or memory
+ *         could not be allocated
+ */
+cache_t* cache_create(uint64_t C, uint64_t B, uint64_t S, enum REPLACEMENT_POLICY policy)
+{
+    cache_layout_t layout;
+    const policy_t* impl = cache_plan(C, B, S, policy, &layout);
+    if (!impl) {
+        return NULL;
+    }
+
+    void* mem;
+    if (posix_memalign(&mem, TAG_ALIGN, layout.total)) return NULL;
+    memset(mem, 0, layout.total);
+    cache_t* cache = mem;
+
+    cache->config.C = C;
+    cache->config.B = B;
+    cache->config.S = S;
+    cache->config.policy = policy;
+    cache_bind(cache, impl, &layout);
+
+    impl->init(cache->policy_state, cache->num_sets, cache->ways);
+    for (uint64_t i = 0; i < cache->num_sets * cache->ways; i++) {
+        cache->tags[i] = INVALID_TAG;
+    }
+    return cache;
+}
+
+static inline uint8_t test_bit(const uint64_t* bitmap, uint64_t bit)
+{
+    return (bitmap[bit / 64] >> (bit % 64)) & 1;
+}
+
+static inline void set_bit(uint64_t* bitmap, uint64_t bit, uint8_t value)
+{
+    uint64_t mask = (uint64_t) 1 << (bit % 64);
+    bitmap[bit / 64] = (bitmap[bit / 64] & ~mask) | ((uint64_t) value << (bit % 64));
+}
+
+/**
+ * Returns the first invalid way of a set, or ways if every way is valid
+ */
+static inline uint64_t find_invalid(const uint64_t* valid, uint64_t ways, uint64_t words)
+{
+    for (uint64_t w = 0; w < words; w++) {
+        uint64_t free_ways = ~valid[w];
+        if (w == words - 1 && ways < 64) {
+            free_ways &= ((uint64_t) 1 << ways) - 1;
+        }
+        if (free_ways) return w * 64 + (uint64_t) __builtin_ctzll(free_ways);
+    }
+    return ways;
+}
+
+/**
+ * Returns the way of a set holding a valid block with the given tag, or
+ * ways if there is none
+ */
+static inline uint64_t find_block(const cache_t* cache, uint64_t tag, uint64_t index)
+{
+    uint64_t ways = cache->ways;
+    const uint64_t* tags = &cache->tags[index * ways];
+    const uint64_t* valid = &cache->flags[index * 2 * cache->words_per_set];
+
+    // Invalid ways hold INVALID_TAG, so only an all-ones tag (possible
+    // when tag_shift is 0) can match one; fall back to checking every
+    // way in that case.
+    uint64_t way = ways < SIMD_MIN_WAYS
+        ? find_way_scalar(tags, ways, tag)
+        : cache->find_way(tags, ways, tag);
+    if (way < ways && !test_bit(valid, way)) {
+        while (way < ways && !(tags[way] == tag && test_bit(valid, way))) way++;
+    }
+    return way;
+}
+
+/**
+ * Brings a block that is not in the cache into its set, replacing an
+ * invalid way if there is one and the policy's victim otherwise
+ *
+ * @param is_prefetch TRUE if the block is brought in by a prefetch
+ * @param victim If not NULL, set to the block that was replaced
+ * @return TRUE if a dirty block was replaced
+ */
+static inline uint8_t fill_block(cache_t* cache, uint64_t tag, uint64_t index,
+                                 uint8_t is_dirty, uint8_t is_prefetch, cache_victim_t* victim)
+{
+    uint64_t ways = cache->ways;
+    uint64_t* tags = &cache->tags[index * ways];
+    uint64_t* valid = &cache->flags[index * 2 * cache->words_per_set];
+    uint64_t* dirty = valid + cache->words_per_set;
 
-// TODO
+    uint64_t way = find_invalid(valid, ways, cache->words_per_set);
+    if (way == ways) {
+        way = cache->policy->victim(cache->policy_state, index, ways);
+    }
+    cache->policy->fill(cache->policy_state, index, way, ways);
 
+    uint8_t was_valid = test_bit(valid, way);
+    uint8_t was_dirty = was_valid && test_bit(dirty, way);
+    uint8_t was_prefetched = FALSE;
+    if (cache->track_prefetch) {
+        uint64_t* prefetched = &cache->prefetched[index * cache->words_per_set];
+        was_prefetched = was_valid && test_bit(prefetched, way);
+        set_bit(prefetched, way, is_prefetch);
+    }
+    if (victim) {
+        victim->valid = was_valid;
+        victim->dirty = was_dirty;
+        victim->prefetched = was_prefetched;
+        victim->address = (tags[way] << cache->tag_shift) | (index << cache->index_shift);
+    }
+
+    tags[way] = tag;
+    set_bit(valid, way, TRUE);
+    set_bit(dirty, way, is_dirty);
+    return was_dirty;
+}
+
+/**
+ * Looks up a block in its set, filling it on a miss. Only the miss and
+ * write back counters are updated here; callers count the accesses.
+ *
+ * @param victim If not NULL, set to the block replaced on a miss
+ * @return FALSE on a miss, CACHE_PREFETCH_HIT on the first hit to a
+ *         prefetched block and TRUE on any other hit
+ */
+static inline uint8_t access_set(cache_t* cache, uint64_t tag, uint64_t index,
+                                 uint8_t is_write, cache_stats_t* stats,
+                                 cache_victim_t* victim)
+{
+    uint64_t way = find_block(cache, tag, index);
+
+    if (way < cache->ways) {
+        cache->policy->hit(cache->policy_state, index, way, cache->ways);
+        if (is_write) {
+            uint64_t* dirty = &cache->flags[(index * 2 + 1) * cache->words_per_set];
+            set_bit(dirty, way, TRUE);
+        }
+        if (victim) victim->valid = FALSE;
+        if (cache->track_prefetch) {
+            uint64_t* prefetched = &cache->prefetched[index * cache->words_per_set];
+            if (test_bit(prefetched, way)) {
+                set_bit(prefetched, way, FALSE);
+                return CACHE_PREFETCH_HIT;
+            }
+        }
+        return TRUE;
+    }
+
+    stats->misses++;
+    if (is_write) {
+        stats->write_misses++;
+    } else {
+        stats->read_misses++;
+    }
+    if (fill_block(cache, tag, index, is_write, FALSE, victim)) {
+        stats->write_backs++;
+    }
+    return FALSE;
+}
+
+/**
+ * Simulates one cache access at a time on the given cache.
+ *
+ * @param cache The cache to access
+ * @param rw The type of access, READ or WRITE
+ * @param address The address that is being accessed
+ * @param stats The struct that you are supposed to store the stats in
+ * @return TRUE if the access is a hit, FALSE if not (CACHE_PREFETCH_HIT
+ *         for the first hit to a prefetched block)
+ */
+uint8_t cache_access_h(cache_t* cache, char rw, uint64_t address, cache_stats_t* stats)
+{
+    uint64_t tag = address >> cache->tag_shift;
+    uint64_t index = (address >> cache->index_shift) & cache->index_mask;
+    uint8_t is_write = rw == WRITE;
+
+    stats->accesses++;
+    if (is_write) {
+        stats->writes++;
+    } else {
+        stats->reads++;
+    }
+    return access_set(cache, tag, index, is_write, stats, NULL);
+}
+
+/**
+ * Simulates one cache access like cache_access_h and also reports the
+ * block replaced on a miss, for caches that feed another level.
+ *
+ * @param victim Set to the replaced block; victim->valid is FALSE on a
+ *        hit or when an invalid way was filled
+ * @return TRUE if the access is a hit, FALSE if not (CACHE_PREFETCH_HIT
+ *         for the first hit to a prefetched block)
+ */
+uint8_t cache_access_victim_h(cache_t* cache, char rw, uint64_t address,
+                              cache_stats_t* stats, cache_victim_t* victim)
+{
+    uint64_t tag = address >> cache->tag_shift;
+    uint64_t index = (address >> cache->index_shift) & cache->index_mask;
+    uint8_t is_write = rw == WRITE;
+
+    stats->accesses++;
+    if (is_write) {
+        stats->writes++;
+    } else {
+        stats->reads++;
+    }
+    return access_set(cache, tag, index, is_write, stats, victim);
+}
+
+/**
+ * Places a block in the cache without counting an access, e.g. a write
+ * back or a victim arriving from the level above. If the block is
+ * already present it is only marked dirty as requested.
+ *
+ * @param address Any address inside the block
+ * @param dirty TRUE if the block arrives dirty
+ * @param victim Set to the block that was replaced to make room
+ * @return TRUE if the block was already present
+ */
+uint8_t cache_fill_h(cache_t* cache, uint64_t address, uint8_t dirty, cache_victim_t* victim)
+{
+    uint64_t tag = address >> cache->tag_shift;
+    uint64_t index = (address >> cache->index_shift) & cache->index_mask;
+    uint64_t way = find_block(cache, tag, index);
+
+    victim->valid = FALSE;
+    if (way < cache->ways) {
+        cache->policy->hit(cache->policy_state, index, way, cache->ways);
+        if (dirty) {
+            set_bit(&cache->flags[(index * 2 + 1) * cache->words_per_set], way, TRUE);
+        }
+        return TRUE;
+    }
+    fill_block(cache, tag, index, dirty, FALSE, victim);
+    return FALSE;
+}
+
+/**
+ * Brings a block into the cache on behalf of a prefetcher, without
+ * counting an access. The block is tagged as prefetched until its first
+ * demand hit, which cache_access_h and friends report as
+ * CACHE_PREFETCH_HIT. Nothing happens if the block is already present.
+ *
+ * @param address Any address inside the block
+ * @param victim Set to the block that was replaced to make room
+ * @return TRUE if the block was already present, so no prefetch was
+ *         issued
+ */
+uint8_t cache_prefetch_h(cache_t* cache, uint64_t address, cache_victim_t* victim)
+{
+    uint64_t tag = address >> cache->tag_shift;
+    uint64_t index = (address >> cache->index_shift) & cache->index_mask;
+
+    cache->track_prefetch = TRUE;
+    victim->valid = FALSE;
+    if (find_block(cache, tag, index) < cache->ways) {
+        return TRUE;
+    }
+    fill_block(cache, tag, index, FALSE, TRUE, victim);
+    return FALSE;
+}
+
+/**
+ * Removes a block from the cache if it is present, without counting an
+ * access
+ *
+ * @param address Any address inside the block
+ * @param dirty Set to TRUE if the removed block was dirty
+ * @return TRUE if the block was present
+ */
+uint8_t cache_invalidate_h(cache_t* cache, uint64_t address, uint8_t* dirty)
+{
+    uint64_t tag = address >> cache->tag_shift;
+    uint64_t index = (address >> cache->index_shift) & cache->index_mask;
+    uint64_t way = find_block(cache, tag, index);
+
+    *dirty = FALSE;
+    if (way == cache->ways) {
+        return FALSE;
+    }
+
+    uint64_t* valid = &cache->flags[index * 2 * cache->words_per_set];
+    *dirty = test_bit(valid + cache->words_per_set, way);
+    set_bit(valid, way, FALSE);
+    set_bit(valid + cache->words_per_set, way, FALSE);
+    set_bit(&cache->prefetched[index * cache->words_per_set], way, FALSE);
+    cache->tags[index * cache->ways + way] = INVALID_TAG;
+    return TRUE;
+}
+
+/**
+ * Computes the tags and indices of n addresses, BATCH_VECTOR at a time
+ * with GCC vector extensions (SSE2 by default, AVX2 when built for it)
+ */
+static void split_addresses(const cache_t* cache, const uint64_t* addresses, size_t n,
+                            uint64_t* tags, uint64_t* indices)
+{
+    size_t i = 0;
+    for (; i + BATCH_VECTOR <= n; i += BATCH_VECTOR) {
+        vec_u64_t address;
+        memcpy(&address, &addresses[i], sizeof(address));
+        vec_u64_t tag = address >> cache->tag_shift;
+        vec_u64_t index = (address >> cache->index_shift) & cache->index_mask;
+        memcpy(&tags[i], &tag, sizeof(tag));
+        memcpy(&indices[i], &index, sizeof(index));
+    }
+    for (; i < n; i++) {
+        tags[i] = addresses[i] >> cache->tag_shift;
+        indices[i] = (addresses[i] >> cache->index_shift) & cache->index_mask;
+    }
+}
+
+/*
+ * Specialized kernels
+ *
+ * run_kernel is cache_access_batch_h written against compile-time
+ * constants: each instantiation below passes its geometry and policy as
+ * literals, so the shifts and masks become immediates, the tag search
+ * of small sets is fully unrolled and the FIFO or LRU update is inlined
+ * in place of the policy_t calls. Tags and indices are computed one
+ * access at a time, which costs nothing once the shifts are constant.
+ *
+ * The kernels skip find_block's check of the valid bit: invalid ways
+ * hold INVALID_TAG, which no tag can equal once tag_shift is nonzero,
+ * and select_kernel only hands out kernels for such configurations.
+ * Caches that track prefetches always take the generic path.
+ */
+
+static inline __attribute__((always_inline))
+void run_kernel(cache_t* cache, const char* rw, const uint64_t* addresses, size_t n,
+                uint8_t* hits, cache_stats_t* stats, uint64_t tag_shift, uint64_t index_shift,
+                uint64_t index_mask, uint64_t S, enum REPLACEMENT_POLICY policy)
+{
+    const uint64_t ways = (uint64_t) 1 << S;
+    const uint64_t words = (ways + 63) / 64;
+    uint64_t* all_tags = cache->tags;
+    uint64_t* all_flags = cache->flags;
+    void* state = cache->policy_state;
+    uint64_t writes = 0;
+    uint64_t read_misses = 0;
+    uint64_t write_misses = 0;
+    uint64_t write_backs = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        if (i + BATCH_PREFETCH < n) {
+            uint64_t ahead = (addresses[i + BATCH_PREFETCH] >> index_shift) & index_mask;
+            __builtin_prefetch(&all_tags[ahead * ways]);
+            __builtin_prefetch(&all_flags[ahead * 2 * words]);
+        }
+
+        uint64_t address = addresses[i];
+        uint64_t tag = address >> tag_shift;
+        uint64_t index = (address >> index_shift) & index_mask;
+        uint8_t is_write = rw[i] == WRITE;
+        uint64_t* tags = &all_tags[index * ways];
+        uint64_t* valid = &all_flags[index * 2 * words];
+        uint64_t* dirty = valid + words;
+        writes += is_write;
+
+        uint64_t way = ways;
+        if (ways < SIMD_MIN_WAYS || ways > 16) {
+            way = ways < SIMD_MIN_WAYS ? find_way_scalar(tags, ways, tag)
+                                       : cache->find_way(tags, ways, tag);
+        } else {
+            for (uint64_t w = ways; w-- > 0; ) {
+                if (tags[w] == tag) way = w;
+            }
+        }
+
+        if (way < ways) {
+            if (policy == LRU) policy_lru_touch(state, index, way, ways);
+            dirty[way / 64] |= (uint64_t) is_write << (way % 64);
+            if (hits) hits[i] = TRUE;
+            continue;
+        }
+
+        read_misses += !is_write;
+        write_misses += is_write;
+        way = find_invalid(valid, ways, words);
+        if (way == ways) {
+            way = policy_lru_victim(state, index, ways);
+            write_backs += test_bit(dirty, way);
+        }
+        policy_lru_touch(state, index, way, ways);
+
+        tags[way] = tag;
+        set_bit(valid, way, TRUE);
+        set_bit(dirty, way, is_write);
+        if (hits) hits[i] = FALSE;
+    }
+
+    stats->accesses += n;
+    stats->writes += writes;
+    stats->reads += n - writes;
+    stats->misses += read_misses + write_misses;
+    stats->read_misses += read_misses;
+    stats->write_misses += write_misses;
+    stats->write_backs += write_backs;
+}
+
+// Geometries with a kernel of their own: every configuration in run_script.sh
+#define KERNEL_GEOMETRIES(X, policy) \
+    X(15, 5, 3, policy) X(10, 5, 0, policy) X(12, 4, 2, policy) \
+    X(16, 4, 2, policy) X(12, 4, 8, policy)
+
+// Associativities with a kernel for any C and B
+#define KERNEL_ASSOCIATIVITIES(X, policy) \
+    X(0, policy) X(1, policy) X(2, policy) X(3, policy) X(4, policy)
+
+#define DEFINE_GEOMETRY_KERNEL(c, b, s, policy) \
+    static void kernel_##policy##_##c##_##b##_##s(cache_t* cache, const char* rw, \
+                                                  const uint64_t* addresses, size_t n, \
+                                                  uint8_t* hits, cache_stats_t* stats) \
+    { \
+        run_kernel(cache, rw, addresses, n, hits, stats, (c) - (s), (b), \
+                   ((uint64_t) 1 << ((c) - (b) - (s))) - 1, (s), policy); \
+    }
+
+#define DEFINE_ASSOCIATIVITY_KERNEL(s, policy) \
+    static void kernel_##policy##_s##s(cache_t* cache, const char* rw, \
+                                       const uint64_t* addresses, size_t n, \
+                                       uint8_t* hits, cache_stats_t* stats) \
+    { \
+        run_kernel(cache, rw, addresses, n, hits, stats, cache->tag_shift, \
+                   cache->index_shift, cache->index_mask, (s), policy); \
+    }
+
+KERNEL_GEOMETRIES(DEFINE_GEOMETRY_KERNEL, FIFO)
+KERNEL_GEOMETRIES(DEFINE_GEOMETRY_KERNEL, LRU)
+KERNEL_ASSOCIATIVITIES(DEFINE_ASSOCIATIVITY_KERNEL, FIFO)
+KERNEL_ASSOCIATIVITIES(DEFINE_ASSOCIATIVITY_KERNEL, LRU)
+
+/**
+ * A kernel and the configurations it handles; C and B of 0 match any
+ */
+typedef struct kernel_entry {
+    config_t config;
+    batch_kernel_t kernel;
+} kernel_entry_t;
+
+#define GEOMETRY_ENTRY(c, b, s, policy) { { c, b, s, policy }, kernel_##policy##_##c##_##b##_##s },
+#define ASSOCIATIVITY_ENTRY(s, policy) { { 0, 0, s, policy }, kernel_##policy##_s##s },
+
+// Exact geometries first, so they win over the associativity kernels
+static const kernel_entry_t kernels[] = {
+    KERNEL_GEOMETRIES(GEOMETRY_ENTRY, FIFO)
+    KERNEL_GEOMETRIES(GEOMETRY_ENTRY, LRU)
+    KERNEL_ASSOCIATIVITIES(ASSOCIATIVITY_ENTRY, FIFO)
+    KERNEL_ASSOCIATIVITIES(ASSOCIATIVITY_ENTRY, LRU)
+};
+
+/**
+ * Picks the specialized kernel for a configuration
+ *
+ * @return The kernel, or NULL if the generic batch path has to be used
+ */
+static batch_kernel_t select_kernel(const config_t* config)
+{
+    if (config->C == config->S) {
+        // tag_shift is 0, so a tag could equal INVALID_TAG
+        return NULL;
+    }
+    for (size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+        const config_t* k = &kernels[i].config;
+        if (k->S == config->S && k->policy == config->policy
+                && ((k->C == config->C && k->B == config->B) || k->C == 0)) {
+            return kernels[i].kernel;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Simulates a batch of accesses in trace order. Tags and indices are
+ * computed for a whole chunk at once, the sets a few accesses ahead are
+ * prefetched, and stats is only updated once at the end.
+ * Configurations with a specialized kernel are handed to it instead.
+ *
+ * @param cache The cache to access
+ * @param rw The type of each access, READ or WRITE
+ * @param addresses The address of each access
+ * @param n The number of accesses
+ * @param hits If not NULL, set to TRUE or FALSE for each access
+ * @param stats The struct to add the stats of the batch to
+ */
+void cache_access_batch_h(cache_t* cache, const char* rw, const uint64_t* addresses,
+                          size_t n, uint8_t* hits, cache_stats_t* stats)
+{
+    if (cache->kernel && !cache->track_prefetch) {
+        cache->kernel(cache, rw, addresses, n, hits, stats);
+        return;
+    }
+
+    uint64_t tags[BATCH_CHUNK];
+    uint64_t indices[BATCH_CHUNK];
+    cache_stats_t batch;
+    memset(&batch, 0, sizeof(cache_stats_t));
+
+    for (size_t start = 0; start < n; start += BATCH_CHUNK) {
+        size_t len = n - start < BATCH_CHUNK ? n - start : BATCH_CHUNK;
+        split_addresses(cache, &addresses[start], len, tags, indices);
+
+        for (size_t i = 0; i < len && i < BATCH_PREFETCH; i++) {
+            __builtin_prefetch(&cache->tags[indices[i] * cache->ways]);
+            __builtin_prefetch(&cache->flags[indices[i] * 2 * cache->words_per_set]);
+        }
+        for (size_t i = 0; i < len; i++) {
+            if (i + BATCH_PREFETCH < len) {
+                __builtin_prefetch(&cache->tags[indices[i + BATCH_PREFETCH] * cache->ways]);
+                __builtin_prefetch(&cache->flags[indices[i + BATCH_PREFETCH] * 2 * cache->words_per_set]);
+            }
+            uint8_t is_write = rw[start + i] == WRITE;
+            batch.writes += is_write;
+            uint8_t is_hit = access_set(cache, tags[i], indices[i], is_write, &batch, NULL);
+            if (hits) hits[start + i] = is_hit;
+        }
+    }
+
+    stats->accesses += n;
+    stats->writes += batch.writes;
+    stats->reads += n - batch.writes;
+    stats->misses += batch.misses;
+    stats->read_misses += batch.read_misses;
+    stats->write_misses += batch.write_misses;
+    stats->write_backs += batch.write_backs;
+}
+
+/**
+ * Frees a cache created by cache_create
+ */
+void cache_destroy(cache_t* cache)
+{
+    if (cache && cache->mapping) {
+        munmap(cache->mapping, cache->mapping_size);
+    } else {
+        free(cache);
+    }
+}
+
+/**
+ * The first page of a checkpoint file. The cache image that follows is
+ * the cache's allocation exactly as it was in memory, so checkpoints
+ * are only meant to be read back by the same build on the same host;
+ * struct_size catches most mismatches.
+ */
+typedef struct checkpoint_header {
+    char magic[8];
+    uint64_t struct_size;   // sizeof(cache_t) of the writer
+    uint64_t image_size;    // Bytes of cache image at CHECKPOINT_IMAGE_OFFSET
+    config_t config;
+    cache_stats_t stats;
+} checkpoint_header_t;
+
+/**
+ * Saves the complete state of a cache, every tag, valid and dirty bit
+ * and the replacement policy's metadata, along with the statistics
+ * gathered so far. The file is written under a temporary name and
+ * renamed into place, so an existing checkpoint at path (which may be
+ * the one this cache was restored from) is only replaced once the new
+ * one is complete.
+ *
+ * @param cache The cache to save
+ * @param stats The statistics to save with it
+ * @param path The path of the checkpoint to write
+ * @return 0 on success, -1 on failure
+ */
+int cache_checkpoint_h(const cache_t* cache, const cache_stats_t* stats, const char* path)
+{
+    char tmp_path[4096];
+    if ((size_t) snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >= sizeof(tmp_path)) {
+        return -1;
+    }
+
+    // On the stack, as handles may be checkpointed from several threads
+    char page[CHECKPOINT_IMAGE_OFFSET] = { 0 };
+    checkpoint_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+    header.struct_size = sizeof(cache_t);
+    header.image_size = cache->size;
+    header.config = cache->config;
+    header.stats = *stats;
+    memcpy(page, &header, sizeof(header));
+
+    FILE* fout = fopen(tmp_path, "wb");
+    if (!fout) return -1;
+    int ok = fwrite(page, sizeof(page), 1, fout) == 1
+        && fwrite(cache, cache->size, 1, fout) == 1;
+    ok = fclose(fout) == 0 && ok;
+    if (!ok || rename(tmp_path, path)) {
+        unlink(tmp_path);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Resumes a cache from a checkpoint written by cache_checkpoint_h. The
+ * file is mapped copy-on-write and the cache is used in place, so
+ * restoring costs a page fault per page the simulation goes on to
+ * touch rather than a read of the whole file.
+ *
+ * @param path The path of the checkpoint
+ * @param stats Set to the statistics saved with the cache
+ * @return The cache, to be freed with cache_destroy, or NULL on failure
+ */
+cache_t* cache_restore_h(const char* path, cache_stats_t* stats)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    void* base = MAP_FAILED;
+    size_t size = 0;
+    if (fstat(fd, &st) == 0 && st.st_size >= CHECKPOINT_IMAGE_OFFSET) {
+        size = (size_t) st.st_size;
+        base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (base == MAP_FAILED) return NULL;
+
+    const checkpoint_header_t* header = base;
+    cache_layout_t layout;
+    const policy_t* impl = NULL;
+    if (memcmp(header->magic, CHECKPOINT_MAGIC, sizeof(header->magic)) == 0
+            && header->struct_size == sizeof(cache_t)) {
+        impl = cache_plan(header->config.C, header->config.B, header->config.S,
+                          header->config.policy, &layout);
+    }
+    if (!impl || layout.total != header->image_size
+            || size - CHECKPOINT_IMAGE_OFFSET < layout.total) {
+        munmap(base, size);
+        return NULL;
+    }
+
+    // Only the pointers need fixing up; everything else is as it was saved
+    cache_t* cache = (cache_t*) (void*) ((char*) base + CHECKPOINT_IMAGE_OFFSET);
+    cache->config = header->config;
+    cache_bind(cache, impl, &layout);
+    cache->mapping = base;
+    cache->mapping_size = size;
+    *stats = header->stats;
+    return cache;
+}
 
 /**
  * Initializes your cache with the passed in arguments.
  *
  * @param C The total size of your cache is 2^C bytes
- * @param S The total number of blocks in a line/set of your cache are 2^S
  * @param B The size of your blocks is 2^B bytes
+ * @param S The total number of blocks in a line/set of your cache are 2^S
  * @param policy The replacement policy of your cache
  */
 void cache_init(uint64_t C, uint64_t B, uint64_t S, enum REPLACEMENT_POLICY policy)
 {
-    // Initialize the cache here. We strongly suggest using arrays for
-    // the cache meta data. The block_t struct given above may be
-    // useful.
-
-    // TODO
-    return NULL;
+    cache_layout_t layout;
+    if (!cache_plan(C, B, S, policy, &layout)) {
+        printf("Invalid cache configuration: C must be at least B + S and less than 64, "
+               "S at most %d and C - B at most %d\n", MAX_S, MAX_BLOCKS);
+        exit(1);
+    }
+    default_cache = cache_create(C, B, S, policy);
+    if (!default_cache) {
+        printf("Out of memory creating the cache\n");
+        exit(1);
+    }
 }
 
 /**
@@ -66,15 +928,18 @@ void cache_init(uint64_t C, uint64_t B, uint64_t S, enum REPLACEMENT_POLICY poli
  */
 uint8_t cache_access(char rw, uint64_t address, cache_stats_t* stats)
 {
-    // Find the tag and index and check if it is a hit. If it is a
-    // miss, then simulate getting the value from memory and putting
-    // it in the cache. Make sure you track the stats along the way!
-
-    uint8_t is_hit = FALSE;
-
-    // TODO
+    return cache_access_h(default_cache, rw, address, stats);
+}
 
-    return is_hit;
+/**
+ * Simulates a batch of accesses on the default cache.
+ *
+ * @see cache_access_batch_h
+ */
+void cache_access_batch(const char* rw, const uint64_t* addresses, size_t n,
+                        uint8_t* hits, cache_stats_t* stats)
+{
+    cache_access_batch_h(default_cache, rw, addresses, n, hits, stats);
 }
 
 /**
@@ -83,11 +948,57 @@ uint8_t cache_access(char rw, uint64_t address, cache_stats_t* stats)
  */
 void cache_cleanup(cache_stats_t* stats)
 {
-    // Make sure to free any malloc'd memory here. To check if you
-    // have freed up the the memory, run valgrind. For more
-    // information, google how to use valgrind.
+    cache_destroy(default_cache);
+    default_cache = NULL;
 
-    // TODO
+    cache_compute_stats(stats);
+}
+
+/**
+ * Saves the default cache and the statistics so far to a checkpoint.
+ * Call before cache_cleanup.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int cache_checkpoint(const cache_stats_t* stats, const char* path)
+{
+    return cache_checkpoint_h(default_cache, stats, path);
+}
+
+/**
+ * Sets up the default cache from a checkpoint instead of cache_init
+ *
+ * @param path The path of the checkpoint
+ * @param C, B, S, policy Set to the configuration of the saved cache
+ * @param stats Set to the statistics saved with the cache
+ */
+void cache_resume(const char* path, uint64_t* C, uint64_t* B, uint64_t* S,
+                  enum REPLACEMENT_POLICY* policy, cache_stats_t* stats)
+{
+    default_cache = cache_restore_h(path, stats);
+    if (!default_cache) {
+        printf("%s is not a checkpoint of this simulator\n", path);
+        exit(1);
+    }
+    *C = default_cache->config.C;
+    *B = default_cache->config.B;
+    *S = default_cache->config.S;
+    *policy = default_cache->config.policy;
+}
+
+/**
+ * Computes the miss rate and average access time from the counters in
+ * a statistics struct
+ *
+ * @param stats The statistics to complete
+ */
+void cache_compute_stats(cache_stats_t* stats)
+{
+    stats->miss_rate = stats->accesses
+        ? (double) stats->misses / (double) stats->accesses
+        : 0.0;
+    stats->avg_access_time = (double) stats->cache_access_time
+        + stats->miss_rate * (double) stats->memory_access_time;
 }
 
 /**
@@ -102,8 +1013,8 @@ void cache_cleanup(cache_stats_t* stats)
  */
 uint64_t get_tag(uint64_t address, uint64_t C, uint64_t B, uint64_t S)
 {
-    // TODO
-    return -1;
+    (void) B;
+    return address >> (C - S);
 }
 
 /**
@@ -118,6 +1029,5 @@ uint64_t get_tag(uint64_t address, uint64_t C, uint64_t B, uint64_t S)
  */
 uint64_t get_index(uint64_t address, uint64_t C, uint64_t B, uint64_t S)
 {
-    // TODO
-    return -1;
+    return (address >> B) & (((uint64_t) 1 << (C - B - S)) - 1);
 }
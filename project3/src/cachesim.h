@@ -25,11 +25,53 @@ typedef struct cache_stats {
     double avg_access_time;
 } cache_stats_t;
 
-enum REPLACEMENT_POLICY { FIFO = 0, LRU = 1};
+enum REPLACEMENT_POLICY { FIFO = 0, LRU = 1, PLRU = 2, SRRIP = 3, BRRIP = 4, RANDOM = 5 };
 
-void cache_init(uint64_t C,  uint64_t S, uint64_t B, enum REPLACEMENT_POLICY policy);
+/*
+ * Handle API. Every cache_t is independent: different handles may be
+ * used from different threads at the same time, but a single handle
+ * must not be accessed concurrently. cache_init, cache_access and
+ * cache_cleanup drive one process-wide default handle.
+ */
+typedef struct cache cache_t;
+
+cache_t* cache_create(uint64_t C, uint64_t B, uint64_t S, enum REPLACEMENT_POLICY policy);
+uint8_t cache_access_h(cache_t* cache, char rw, uint64_t address, cache_stats_t* stats);
+void cache_access_batch_h(cache_t* cache, const char* rw, const uint64_t* addresses,
+                          size_t n, uint8_t* hits, cache_stats_t* stats);
+void cache_destroy(cache_t* cache);
+int cache_checkpoint_h(const cache_t* cache, const cache_stats_t* stats, const char* path);
+cache_t* cache_restore_h(const char* path, cache_stats_t* stats);
+
+/**
+ * A block pushed out of a cache, for simulating multi-level hierarchies
+ */
+typedef struct cache_victim {
+    uint8_t valid;          // FALSE if no valid block was replaced
+    uint8_t dirty;
+    uint8_t prefetched;     // The block was prefetched and never used
+    uint64_t address;       // Address of the first byte of the block
+} cache_victim_t;
+
+// Returned instead of TRUE by the access functions for the first demand
+// hit to a block brought in by cache_prefetch_h
+#define CACHE_PREFETCH_HIT 2
+
+uint8_t cache_access_victim_h(cache_t* cache, char rw, uint64_t address,
+                              cache_stats_t* stats, cache_victim_t* victim);
+uint8_t cache_fill_h(cache_t* cache, uint64_t address, uint8_t dirty, cache_victim_t* victim);
+uint8_t cache_invalidate_h(cache_t* cache, uint64_t address, uint8_t* dirty);
+uint8_t cache_prefetch_h(cache_t* cache, uint64_t address, cache_victim_t* victim);
+
+void cache_init(uint64_t C, uint64_t B, uint64_t S, enum REPLACEMENT_POLICY policy);
 uint8_t cache_access(char rw, uint64_t address, cache_stats_t* stats);
+void cache_access_batch(const char* rw, const uint64_t* addresses, size_t n,
+                        uint8_t* hits, cache_stats_t* stats);
 void cache_cleanup(cache_stats_t* stats);
+int cache_checkpoint(const cache_stats_t* stats, const char* path);
+void cache_resume(const char* path, uint64_t* C, uint64_t* B, uint64_t* S,
+                  enum REPLACEMENT_POLICY* policy, cache_stats_t* stats);
+void cache_compute_stats(cache_stats_t* stats);
 
 uint64_t get_tag(uint64_t address, uint64_t C, uint64_t B, uint64_t S);
 uint64_t get_index(uint64_t address, uint64_t C, uint64_t B, uint64_t S);
@@ -41,6 +83,7 @@ static const enum REPLACEMENT_POLICY DEFAULT_R = FIFO;
 
 static const char READ = 'r';
 static const char WRITE = 'w';
+static const char FETCH = 'i';   // Instruction fetch, a read that goes to L1I
 
 #endif
 
@@ -1,44 +1,138 @@
 // DO NOT MODIFY THIS FILE!
 
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <getopt.h>
 #include "cachesim.h"
+#include "hier.h"
+#include "interval.h"
+#include "missclass.h"
+#include "output.h"
+#include "policy.h"
+#include "prefetch.h"
+#include "reader.h"
+#include "sample.h"
+#include "stackdist.h"
+#include "sweep.h"
+#include "trace.h"
 
 #define TRUE 1
 #define FALSE 0
 
+static void print_settings(uint64_t c, uint64_t b, uint64_t s, enum REPLACEMENT_POLICY r);
 static void print_statistics(cache_stats_t* p_stats);
+static void print_miss_classes(const miss_classes_t* classes);
+static void run_miss_curve(trace_t* trace, uint64_t c, uint64_t b, uint64_t s);
+static void run_sweep(const char* config_path, const char* const* traces, size_t num_traces,
+                      unsigned threads, uint8_t classify);
+static void run_hierarchy(trace_t* trace, const char* hier_path);
+static void run_chunked(const char* trace_path, uint64_t c, uint64_t b, uint64_t s,
+                        enum REPLACEMENT_POLICY r, size_t chunks, long warmup,
+                        unsigned threads, uint8_t validate);
+static void run_prefetch(trace_t* trace, uint64_t c, uint64_t b, uint64_t s,
+                         enum REPLACEMENT_POLICY r, const prefetcher_t* prefetcher,
+                         uint64_t degree, uint64_t latency, uint8_t should_print,
+                         const char* results_path, uint8_t threaded_output);
+static void run_sampled(trace_t* trace, uint64_t c, uint64_t b, uint64_t s,
+                        enum REPLACEMENT_POLICY r, uint64_t ratio);
+
+static void start_reader(reader_t* reader, trace_t* trace) {
+    if (reader_start(reader, trace)) {
+        printf("Out of memory\n");
+        exit(1);
+    }
+}
+
+/**
+ * Starts the per-access output: binary records to results_path if it
+ * is set, -p lines on stdout otherwise
+ *
+ * @return The file descriptor written to
+ */
+static int open_output(output_t* output, const char* results_path, uint8_t threaded) {
+    int fd = STDOUT_FILENO;
+    if (results_path && (fd = open(results_path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+        perror("Unable to open results file");
+        exit(1);
+    }
+    if (output_open(output, fd, results_path ? OUTPUT_BINARY : OUTPUT_TEXT, threaded)) {
+        printf("Out of memory\n");
+        exit(1);
+    }
+    return fd;
+}
+
+static void close_output(output_t* output, int fd) {
+    if (output_close(output) || (fd != STDOUT_FILENO && close(fd))) {
+        perror("Unable to write results");
+        exit(1);
+    }
+}
 
 static void print_help_and_exit(void) {
     printf("cachesim [OPTIONS] < traces/file.trace\n");
+    printf("cachesim [OPTIONS] -x configs traces/file.trace...\n");
     printf("  -C\t\tTotal size of the cache in bytes is 2^S\n");
     printf("  -B\t\tSize of each block in bytes is 2^B\n");
     printf("  -S\t\tNumber of blocks per set is 2^S\n");
+    printf("  -i\t\tRead the trace from the given file instead of stdin (text or binary, optionally gzip, zstd or xz compressed)\n");
+    printf("  -w\t\tConvert the input trace to the binary format in the given file and exit\n");
     printf("  -p\t\tPrint out every access (use this to compare to given solutions)\n");
-    printf("  -r\t\tThe replacement policy (FIFO or LRU)\n");
+    printf("  -b\t\tWrite the result of every access to the given file as binary records instead of printing them (-p)\n");
+    printf("  -r\t\tThe replacement policy (FIFO, LRU, PLRU, SRRIP, BRRIP or RANDOM)\n");
+    printf("  -m\t\tSimulate every LRU cache with C up to -C and S up to -S at block size -B in one pass\n");
+    printf("  -x\t\tSimulate every \"C B S policy [name]\" line of the given file on every trace\n");
+    printf("  -t\t\tNumber of threads used by -x (defaults to the number of CPUs)\n");
+    printf("  -k\t\tSimulate only 1 in the given power of two sets and extrapolate, with 95%% confidence intervals\n");
+    printf("  -P\t\tSplit the trace into the given number of chunks and simulate them in parallel\n");
+    printf("  -W\t\tAccesses replayed to warm up each chunk of -P (defaults to 8 times the blocks in the cache)\n");
+    printf("  -V\t\tWith -P, also run the trace serially and report the difference\n");
+    printf("  -H\t\tSimulate the multi-level cache hierarchy described in the given file\n");
+    printf("  -f\t\tPrefetch with the given prefetcher (NEXTLINE, STRIDE or STREAM)\n");
+    printf("  -D\t\tBlocks fetched per prefetcher trigger (defaults to 2)\n");
+    printf("  -L\t\tAccesses before a prefetched block arrives, for late prefetches (defaults to 8)\n");
+    printf("  -c\t\tClassify misses as compulsory, capacity or conflict (also with -x)\n");
+    printf("  -M\t\tWrite a per-set CSV heatmap of accesses, misses and conflicts to the given file (implies -c)\n");
+    printf("  -u\t\tWarm the cache with the given number of accesses before counting statistics\n");
+    printf("  -n\t\tStop after the given number of accesses, warmup included\n");
+    printf("  -I\t\tRecord the statistics of every interval of the given number of accesses (needs -O)\n");
+    printf("  -O\t\tWrite the -I time series to the given file, as JSON if it ends in .json and CSV otherwise\n");
+    printf("  -o\t\tSave the cache state and statistics to the given checkpoint after the trace\n");
+    printf("  -R\t\tResume from the given checkpoint, skipping the accesses it has already simulated (its C, B, S and policy are used)\n");
     printf("  -h\t\tThis helpful output\n");
     exit(0);
 }
 
+/**
+ * Parses the positive number given to an option, exiting with a message
+ * if it is zero, negative or not a number
+ */
+static uint64_t get_count(int opt, const char* arg) {
+    char* end;
+    errno = 0;
+    uint64_t value = strtoull(arg, &end, 0);
+    if (end == arg || *end || errno || value == 0 || strchr(arg, '-')) {
+        printf("-%c needs a positive number, not \"%s\"\n", opt, arg);
+        exit(1);
+    }
+    return value;
+}
+
 static enum REPLACEMENT_POLICY get_policy(char* name) {
-    if (strcmp(name, "LRU") == 0 || strcmp(name, "lru") == 0) {
-        return LRU;
+    enum REPLACEMENT_POLICY policy;
+    if (policy_from_name(name, &policy)) {
+        printf("Unknown replacement policy: %s\n", name);
+        print_help_and_exit();
     }
-    return FIFO;
+    return policy;
 }
 
 static void get_policy_name(char* name, enum REPLACEMENT_POLICY policy) {
-    switch (policy) {
-        case FIFO:
-            strcpy(name, "FIFO");
-            break;
-        case LRU:
-            strcpy(name, "LRU");
-            break;
-        }
+    strcpy(name, policy_name(policy));
 }
 
 int main(int argc, char* argv[]) {
@@ -47,11 +141,32 @@ int main(int argc, char* argv[]) {
     uint64_t b = DEFAULT_B;
     uint64_t s = DEFAULT_S;
     uint8_t should_print = FALSE;
+    uint8_t miss_curve = FALSE;
     enum REPLACEMENT_POLICY r = FIFO;
-    FILE* fin  = stdin;
+    const char* trace_path = NULL;
+    const char* convert_path = NULL;
+    const char* sweep_path = NULL;
+    const char* hier_path = NULL;
+    uint64_t sample_ratio = 1;
+    size_t chunks = 0;
+    long warmup = -1;
+    uint8_t validate = FALSE;
+    uint8_t classify = FALSE;
+    const char* heatmap_path = NULL;
+    const char* checkpoint_path = NULL;
+    const char* resume_path = NULL;
+    const char* results_path = NULL;
+    uint64_t warmup_accesses = 0;
+    uint64_t stop_after = 0;
+    uint64_t interval = 0;
+    const char* interval_path = NULL;
+    const prefetcher_t* prefetcher = NULL;
+    uint64_t degree = 2;
+    uint64_t latency = 8;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
 
     // Read arguments 
-    while(-1 != (opt = getopt(argc, argv, "C:B:S:r:i:ph"))) {
+    while(-1 != (opt = getopt(argc, argv, "C:B:S:r:i:w:x:t:H:k:P:W:M:f:D:L:o:R:b:u:n:I:O:Vcmph"))) {
         switch(opt) {
             case 'C':
                 c = strtoull(optarg, NULL, 0);
@@ -68,9 +183,78 @@ int main(int argc, char* argv[]) {
             case 'p':
                 should_print = TRUE;
                 break;
+            case 'u':
+                warmup_accesses = strtoull(optarg, NULL, 0);
+                break;
+            case 'n':
+                stop_after = strtoull(optarg, NULL, 0);
+                break;
+            case 'I':
+                interval = strtoull(optarg, NULL, 0);
+                break;
+            case 'O':
+                interval_path = optarg;
+                break;
+            case 'b':
+                results_path = optarg;
+                should_print = TRUE;
+                break;
+            case 'm':
+                miss_curve = TRUE;
+                break;
+            case 'x':
+                sweep_path = optarg;
+                break;
+            case 't':
+                threads = strtol(optarg, NULL, 0);
+                break;
+            case 'P':
+                chunks = (size_t) get_count(opt, optarg);
+                break;
+            case 'W':
+                warmup = strtol(optarg, NULL, 0);
+                break;
+            case 'f':
+                prefetcher = prefetcher_from_name(optarg);
+                if (!prefetcher) {
+                    printf("Unknown prefetcher: %s\n", optarg);
+                    print_help_and_exit();
+                }
+                break;
+            case 'D':
+                degree = strtoull(optarg, NULL, 0);
+                break;
+            case 'L':
+                latency = strtoull(optarg, NULL, 0);
+                break;
+            case 'c':
+                classify = TRUE;
+                break;
+            case 'M':
+                heatmap_path = optarg;
+                classify = TRUE;
+                break;
+            case 'o':
+                checkpoint_path = optarg;
+                break;
+            case 'R':
+                resume_path = optarg;
+                break;
+            case 'V':
+                validate = TRUE;
+                break;
+            case 'k':
+                sample_ratio = strtoull(optarg, NULL, 0);
+                break;
+            case 'H':
+                hier_path = optarg;
+                break;
             case 'i':
-                fin = fopen(optarg, "r");
-                continue;
+                trace_path = optarg;
+                break;
+            case 'w':
+                convert_path = optarg;
+                break;
             case 'h':
             default:
                 print_help_and_exit();
@@ -78,48 +262,526 @@ int main(int argc, char* argv[]) {
         }
     }
 
-    char name[10];
-    get_policy_name(name, r);
+    if (warmup_accesses && checkpoint_path) {
+        printf("-u cannot be used with -o; a checkpoint must count every access it has seen\n");
+        exit(1);
+    }
+    if (!interval != !interval_path) {
+        printf("-I and -O must be used together\n");
+        exit(1);
+    }
 
-    printf("Cache Settings\n");
-    printf("C: %" PRIu64 "\n", c);
-    printf("B: %" PRIu64 "\n", b);
-    printf("S: %" PRIu64 "\n", s);
-    printf("Replacement policy: %s\n", name);
+    // Warmup, stopping early, intervals, checkpoints and the heatmap are only
+    // supported by the plain simulation loop, so refuse them in other modes
+    // instead of silently ignoring them (-x classifies misses on its own)
+    const char* mode = sweep_path ? "-x" : chunks ? "-P" : convert_path ? "-w"
+                     : miss_curve ? "-m" : hier_path ? "-H" : prefetcher ? "-f"
+                     : sample_ratio != 1 ? "-k" : NULL;
+    const char* unsupported = warmup_accesses ? "-u" : stop_after ? "-n"
+                            : interval ? "-I" : checkpoint_path ? "-o"
+                            : resume_path ? "-R" : heatmap_path ? "-M"
+                            : classify && !sweep_path ? "-c" : NULL;
+    if (mode && unsupported) {
+        printf("%s cannot be used with %s\n", unsupported, mode);
+        exit(1);
+    }
+    // Only the plain loop and -f report every access
+    if (mode && strcmp(mode, "-f") && should_print) {
+        printf("%s cannot be used with %s\n", results_path ? "-b" : "-p", mode);
+        exit(1);
+    }
+
+    if (sweep_path) {
+        if (optind < argc) {
+            run_sweep(sweep_path, (const char* const*) &argv[optind],
+                      (size_t) (argc - optind), threads > 0 ? (unsigned) threads : 1, classify);
+        } else if (trace_path) {
+            run_sweep(sweep_path, &trace_path, 1, threads > 0 ? (unsigned) threads : 1, classify);
+        } else {
+            printf("-x needs the traces to simulate, either after the options or with -i\n");
+            exit(1);
+        }
+        return 0;
+    }
+
+    if (chunks) {
+        // The chunks need random access to the trace, so stdin is
+        // opened by path and read in full before the simulation starts
+        run_chunked(trace_path ? trace_path : "/dev/stdin", c, b, s, r, chunks, warmup,
+                    threads > 0 ? (unsigned) threads : 1, validate);
+        return 0;
+    }
+
+    trace_t trace;
+    if (trace_path) {
+        if (trace_open(&trace, trace_path)) {
+            perror("Unable to open trace file");
+            exit(1);
+        }
+    } else if (trace_open_file(&trace, stdin)) {
+        printf("Unable to read trace from stdin\n");
+        exit(1);
+    }
+
+    if (convert_path) {
+        uint64_t count;
+        if (trace_convert(&trace, convert_path, &count)) {
+            perror("Unable to write binary trace");
+            exit(1);
+        }
+        printf("Wrote %" PRIu64 " accesses to %s\n", count, convert_path);
+        trace_close(&trace);
+        return 0;
+    }
+
+    if (miss_curve) {
+        run_miss_curve(&trace, c, b, s);
+        trace_close(&trace);
+        return 0;
+    }
+
+    if (hier_path) {
+        run_hierarchy(&trace, hier_path);
+        trace_close(&trace);
+        return 0;
+    }
+
+    // -t only sizes the -x pool; -p output is written from a background
+    // thread whenever there is a spare CPU to run it on
+    uint8_t threaded_output = sysconf(_SC_NPROCESSORS_ONLN) > 1;
+    if (prefetcher) {
+        run_prefetch(&trace, c, b, s, r, prefetcher, degree, latency, should_print,
+                     results_path, threaded_output);
+        trace_close(&trace);
+        return 0;
+    }
+
+    if (sample_ratio != 1) {
+        run_sampled(&trace, c, b, s, r, sample_ratio);
+        trace_close(&trace);
+        return 0;
+    }
+
+    // Setup the cache and statistics, either fresh or from a checkpoint
+    cache_stats_t stats;
+    if (resume_path) {
+        if (classify) {
+            printf("-c cannot classify misses when resuming from a checkpoint (-R)\n");
+            exit(1);
+        }
+        cache_resume(resume_path, &c, &b, &s, &r, &stats);
+        uint64_t skipped = trace_skip(&trace, stats.accesses);
+        if (skipped < stats.accesses) {
+            printf("The trace has only %" PRIu64 " of the %" PRIu64
+                   " accesses already simulated by %s\n", skipped, stats.accesses, resume_path);
+            exit(1);
+        }
+        print_settings(c, b, s, r);
+    } else {
+        print_settings(c, b, s, r);
+        cache_init(c, b, s, r);
+        memset(&stats, 0, sizeof(cache_stats_t));
+        stats.cache_access_time = 3;
+        stats.memory_access_time = 120;
+    }
+
+    interval_log_t intervals;
+    if (interval && interval_open(&intervals, interval_path, &stats)) {
+        perror("Unable to write interval statistics");
+        exit(1);
+    }
+
+    // Optional 3C classification of the misses
+    missclass_t* mc = NULL;
+    miss_classes_t classes;
+    memset(&classes, 0, sizeof(miss_classes_t));
+    if (classify && !(mc = missclass_create(c, b, s))) {
+        printf("Unable to set up miss classification for this cache\n");
+        exit(1);
+    }
+
+    // Per-access results are formatted into large buffers instead of printf
+    output_t output;
+    int output_fd = should_print ? open_output(&output, results_path, threaded_output) : -1;
+
+    // Begin reading the file; batches are decoded ahead on another thread
+    reader_t reader;
+    start_reader(&reader, &trace);
+    static uint8_t hits[READER_BATCH];
+    uint8_t* batch_hits = should_print || mc ? hits : NULL;
+    cache_stats_t warmup_stats;
+    miss_classes_t warmup_classes;
+    memset(&warmup_stats, 0, sizeof(cache_stats_t));
+    memset(&warmup_classes, 0, sizeof(miss_classes_t));
+    uint64_t position = 0;      // Accesses simulated by this run, warmup included
+    const access_batch_t* batch;
+    while ((batch = reader_next(&reader))) {
+        size_t n = batch->n;
+        if (stop_after && n > stop_after - position) {
+            n = (size_t) (stop_after - position);
+        }
+
+        // Batches are split where the warmup or an interval ends, so the
+        // loop only does extra work once per slice
+        for (size_t done = 0; done < n; ) {
+            size_t len = n - done;
+            cache_stats_t* slice_stats = &stats;
+            miss_classes_t* slice_classes = &classes;
+            if (position < warmup_accesses) {
+                if (len > warmup_accesses - position) len = (size_t) (warmup_accesses - position);
+                slice_stats = &warmup_stats;
+                slice_classes = &warmup_classes;
+            } else if (interval) {
+                uint64_t left = interval - (position - warmup_accesses) % interval;
+                if (len > left) len = (size_t) left;
+            }
+
+            cache_access_batch(&batch->rw[done], &batch->addresses[done], len,
+                               batch_hits ? &batch_hits[done] : NULL, slice_stats);
+            if (mc) {
+                missclass_batch(mc, &batch->addresses[done], &hits[done], len, slice_classes);
+            }
+            position += len;
+            done += len;
+            if (interval && slice_stats == &stats
+                    && (position - warmup_accesses) % interval == 0) {
+                interval_record(&intervals, position, &stats);
+            }
+        }
+
+        for (size_t i = 0; should_print && i < n; i++) {
+            output_access(&output, batch->addresses[i], hits[i],
+                          get_tag(batch->addresses[i], c, b, s),
+                          get_index(batch->addresses[i], c, b, s));
+        }
+        if (stop_after && position == stop_after) break;
+    }
+    reader_stop(&reader);
+    if (should_print) {
+        close_output(&output, output_fd);
+    }
+    if (interval) {
+        // The last interval may be a partial one
+        interval_record(&intervals, position, &stats);
+        if (interval_close(&intervals)) {
+            perror("Unable to write interval statistics");
+            exit(1);
+        }
+    }
+
+    if (checkpoint_path && cache_checkpoint(&stats, checkpoint_path)) {
+        perror("Unable to write checkpoint");
+        exit(1);
+    }
+
+    printf("\n");
+    cache_cleanup(&stats);
+    print_statistics(&stats);
+    if (mc) {
+        print_miss_classes(&classes);
+        if (heatmap_path && missclass_write_heatmap(mc, heatmap_path)) {
+            perror("Unable to write heatmap");
+            exit(1);
+        }
+        missclass_destroy(mc);
+    }
+    trace_close(&trace);
+    return 0;
+}
+
+/**
+ * Runs the trace through the single-pass LRU simulator and prints the
+ * statistics of every cache with block size 2^b, size up to 2^c and
+ * associativity up to 2^s
+ */
+static void run_miss_curve(trace_t* trace, uint64_t c, uint64_t b, uint64_t s) {
+    stackdist_t* sd = stackdist_create(c, b, s);
+    if (!sd) {
+        printf("Unable to set up the single-pass simulation for C <= %" PRIu64
+               ", B = %" PRIu64 ", S <= %" PRIu64 "\n", c, b, s);
+        exit(1);
+    }
+
+    reader_t reader;
+    start_reader(&reader, trace);
+    const access_batch_t* batch;
+    while ((batch = reader_next(&reader))) {
+        for (size_t i = 0; i < batch->n; i++) {
+            stackdist_access(sd, batch->rw[i], batch->addresses[i]);
+        }
+    }
+    reader_stop(&reader);
+
+    for (uint64_t ci = b; ci <= c; ci++) {
+        for (uint64_t si = 0; si <= s && b + si <= ci; si++) {
+            cache_stats_t stats;
+            memset(&stats, 0, sizeof(cache_stats_t));
+            stats.cache_access_time = 3;
+            stats.memory_access_time = 120;
+            stackdist_stats(sd, ci, si, &stats);
+
+            if (ci != b || si != 0) {
+                printf("\n");
+            }
+            print_settings(ci, b, si, LRU);
+            printf("\n");
+            print_statistics(&stats);
+        }
+    }
+    stackdist_destroy(sd);
+}
+
+/**
+ * Simulates every configuration listed in config_path on every trace
+ * and prints the results grouped by configuration, in the layout of
+ * run_script.sh. Unlike the script, every title after the first is
+ * preceded by a blank line, so the output is not byte-identical to it.
+ */
+static void run_sweep(const char* config_path, const char* const* traces, size_t num_traces,
+                      unsigned threads, uint8_t classify) {
+    sweep_config_t* configs;
+    size_t num_configs;
+    if (sweep_load_configs(config_path, &configs, &num_configs)) {
+        exit(1);
+    }
+
+    cache_stats_t* results = calloc(num_configs * num_traces, sizeof(cache_stats_t));
+    if (!results && num_configs && num_traces) {
+        printf("Out of memory\n");
+        exit(1);
+    }
+    miss_classes_t* classes = NULL;
+    if (classify) {
+        classes = calloc(num_configs * num_traces, sizeof(miss_classes_t));
+        if (!classes && num_configs && num_traces) {
+            printf("Out of memory\n");
+            exit(1);
+        }
+    }
+    if (sweep_run(configs, num_configs, traces, num_traces, threads, results, classes)) {
+        exit(1);
+    }
+
+    for (size_t i = 0; i < num_configs; i++) {
+        const sweep_config_t* config = &configs[i];
+        if (config->name[0]) {
+            printf("%s%s\n", i ? "\n" : "", config->name);
+        }
+        for (size_t t = 0; t < num_traces; t++) {
+            const char* base = strrchr(traces[t], '/');
+            printf("\n--%s--\n", base ? base + 1 : traces[t]);
+            print_settings(config->C, config->B, config->S, config->policy);
+            printf("\n");
+            print_statistics(&results[i * num_traces + t]);
+            if (classes) {
+                print_miss_classes(&classes[i * num_traces + t]);
+            }
+        }
+    }
+    free(classes);
+    free(results);
+    free(configs);
+}
+
+/**
+ * Simulates the trace in parallel chunks and prints the merged
+ * statistics, and with validate how far they are from a serial run
+ */
+static void run_chunked(const char* trace_path, uint64_t c, uint64_t b, uint64_t s,
+                        enum REPLACEMENT_POLICY r, size_t chunks, long warmup,
+                        unsigned threads, uint8_t validate) {
+    sweep_config_t config;
+    memset(&config, 0, sizeof(sweep_config_t));
+    config.C = c;
+    config.B = b;
+    config.S = s;
+    config.policy = r;
+    if (c < b + s) {
+        printf("Invalid cache configuration\n");
+        exit(1);
+    }
+    uint64_t warmup_accesses = warmup >= 0 ? (uint64_t) warmup : (uint64_t) 8 << (c - b);
+
+    cache_stats_t stats;
+    if (sweep_run_chunked(&config, trace_path, &chunks, warmup_accesses, threads, &stats)) {
+        exit(1);
+    }
+
+    print_settings(c, b, s, r);
+    printf("\n");
+    print_statistics(&stats);
+    printf("Chunks: %zu (warmup %" PRIu64 " accesses each)\n", chunks, warmup_accesses);
+
+    if (validate) {
+        cache_stats_t serial;
+        size_t one = 1;
+        if (sweep_run_chunked(&config, trace_path, &one, 0, 1, &serial)) {
+            exit(1);
+        }
+        printf("Serial misses: %" PRIu64 "\n", serial.misses);
+        printf("Serial writebacks: %" PRIu64 "\n", serial.write_backs);
+        printf("Miss rate delta: %+f\n", stats.miss_rate - serial.miss_rate);
+        printf("AAT delta: %+f\n", stats.avg_access_time - serial.avg_access_time);
+    }
+}
+
+/**
+ * Simulates the cache with a prefetcher attached and prints the demand
+ * statistics followed by the prefetch statistics
+ */
+static void run_prefetch(trace_t* trace, uint64_t c, uint64_t b, uint64_t s,
+                         enum REPLACEMENT_POLICY r, const prefetcher_t* prefetcher,
+                         uint64_t degree, uint64_t latency, uint8_t should_print,
+                         const char* results_path, uint8_t threaded_output) {
+    prefetch_sim_t* sim = prefetch_sim_create(c, b, s, r, prefetcher, degree, latency);
+    if (!sim) {
+        printf("Unable to set up prefetching; the degree must be 1 to %d\n", PREFETCH_MAX_DEGREE);
+        exit(1);
+    }
 
-    // Setup the cache
-    cache_init(c, b, s, r);
+    print_settings(c, b, s, r);
 
-    // Setup statistics
     cache_stats_t stats;
+    prefetch_stats_t pstats;
     memset(&stats, 0, sizeof(cache_stats_t));
+    memset(&pstats, 0, sizeof(prefetch_stats_t));
     stats.cache_access_time = 3;
     stats.memory_access_time = 120;
 
-    // Begin reading the file 
-    char rw;
-    uint64_t address;
-    while (!feof(fin)) { 
-        int ret = fscanf(fin, "%c %" SCNx64 "\n", &rw, &address); 
-        if (ret == 2) {
-            uint8_t is_hit = cache_access(rw, address, &stats);
+    output_t output;
+    int output_fd = should_print ? open_output(&output, results_path, threaded_output) : -1;
+
+    reader_t reader;
+    start_reader(&reader, trace);
+    const access_batch_t* batch;
+    while ((batch = reader_next(&reader))) {
+        for (size_t i = 0; i < batch->n; i++) {
+            uint64_t address = batch->addresses[i];
+            uint8_t hit = prefetch_sim_access(sim, batch->rw[i], address, &stats, &pstats);
             if (should_print) {
-                printf(
-                    "0x%012" PRIx64 "\t%s\t0x%012" PRIx64 "\t0x%012" PRIx64 "\n",
-                    address,
-                    is_hit ? "hit " : "miss",
-                    get_tag(address, c, b, s),
-                    get_index(address, c, b, s)
-                );                
+                output_access(&output, address, hit, get_tag(address, c, b, s),
+                              get_index(address, c, b, s));
             }
         }
     }
+    reader_stop(&reader);
+    if (should_print) {
+        close_output(&output, output_fd);
+    }
+    prefetch_sim_destroy(sim);
 
+    cache_compute_stats(&stats);
     printf("\n");
-    cache_cleanup(&stats);
     print_statistics(&stats);
-    fclose(fin);
-    return 0;
+    printf("Prefetcher: %s (degree %" PRIu64 ", latency %" PRIu64 ")\n",
+           prefetcher->name, degree, latency);
+    printf("Prefetches issued: %" PRIu64 "\n", pstats.issued);
+    printf("Useful prefetches: %" PRIu64 "\n", pstats.useful);
+    printf("Late prefetches: %" PRIu64 "\n", pstats.late);
+    printf("Polluting prefetches: %" PRIu64 "\n", pstats.polluting);
+    printf("Unused prefetches: %" PRIu64 "\n", pstats.unused);
+    printf("Prefetch accuracy: %f\n", pstats.issued
+           ? (double) (pstats.useful + pstats.late) / (double) pstats.issued : 0.0);
+    printf("Prefetch coverage: %f\n", pstats.useful + stats.misses
+           ? (double) pstats.useful / (double) (pstats.useful + stats.misses) : 0.0);
+    printf("Effective AAT: %f\n", prefetch_effective_aat(&stats, &pstats));
+}
+
+/**
+ * Simulates 1 in ratio sets of the cache and prints the extrapolated
+ * statistics with their confidence intervals
+ */
+static void run_sampled(trace_t* trace, uint64_t c, uint64_t b, uint64_t s,
+                        enum REPLACEMENT_POLICY r, uint64_t ratio) {
+    sampler_t* sampler = sampler_create(c, b, s, r, ratio);
+    if (!sampler) {
+        printf("Unable to sample 1 in %" PRIu64 " sets; the ratio must be a power of two"
+               " no larger than the number of sets\n", ratio);
+        exit(1);
+    }
+
+    print_settings(c, b, s, r);
+
+    reader_t reader;
+    start_reader(&reader, trace);
+    const access_batch_t* batch;
+    while ((batch = reader_next(&reader))) {
+        sampler_access_batch(sampler, batch->rw, batch->addresses, batch->n);
+    }
+    reader_stop(&reader);
+
+    cache_stats_t stats;
+    sample_bounds_t bounds;
+    memset(&stats, 0, sizeof(cache_stats_t));
+    stats.cache_access_time = 3;
+    stats.memory_access_time = 120;
+    sampler_stats(sampler, &stats, &bounds);
+    sampler_destroy(sampler);
+
+    printf("\n");
+    print_statistics(&stats);
+    printf("Sampled sets: %" PRIu64 " of %" PRIu64 "\n", bounds.sampled_sets, bounds.num_sets);
+    printf("Sampled accesses: %" PRIu64 "\n", bounds.sampled_accesses);
+    printf("Miss rate 95%% CI: [%f, %f]\n", bounds.miss_rate_low, bounds.miss_rate_high);
+    printf("AAT 95%% CI: [%f, %f]\n", bounds.aat_low, bounds.aat_high);
+}
+
+/**
+ * Runs the trace through the cache hierarchy described in hier_path and
+ * prints the statistics of each level, then of the whole hierarchy
+ */
+static void run_hierarchy(trace_t* trace, const char* hier_path) {
+    hier_t hier;
+    if (hier_load(hier_path, &hier)) {
+        exit(1);
+    }
+
+    reader_t reader;
+    start_reader(&reader, trace);
+    const access_batch_t* batch;
+    while ((batch = reader_next(&reader))) {
+        for (size_t i = 0; i < batch->n; i++) {
+            hier_access(&hier, batch->rw[i], batch->addresses[i]);
+        }
+    }
+    reader_stop(&reader);
+    hier_finish(&hier);
+
+    for (uint64_t i = 0; i <= hier.num_levels; i++) {
+        // The L1I, if there is one, is printed before the L1D
+        hier_level_t* level = i == 0 ? &hier.l1i : &hier.levels[i - 1];
+        if (i == 0 && !hier.has_l1i) continue;
+
+        printf("--%s--\n", level->name);
+        print_settings(level->C, level->B, level->S, level->policy);
+        printf("\n");
+        print_statistics(&level->stats);
+        if (hier.inclusion == INCLUSIVE && i > 1) {
+            printf("Back invalidations: %" PRIu64 "\n", level->back_invalidations);
+        }
+        printf("\n");
+    }
+
+    const char* inclusion = hier.inclusion == INCLUSIVE ? "inclusive"
+                          : hier.inclusion == EXCLUSIVE ? "exclusive" : "non-inclusive";
+    printf("Hierarchy Statistics\n");
+    printf("Inclusion: %s\n", inclusion);
+    printf("Memory reads: %" PRIu64 "\n", hier.memory_reads);
+    printf("Memory writes: %" PRIu64 "\n", hier.memory_writes);
+    printf("Memory access time: %" PRIu64 "\n", hier.memory_access_time);
+    printf("Average access time (AAT): %f\n", hier.avg_access_time);
+    hier_destroy(&hier);
+}
+
+static void print_settings(uint64_t c, uint64_t b, uint64_t s, enum REPLACEMENT_POLICY r) {
+    char name[10];
+    get_policy_name(name, r);
+
+    printf("Cache Settings\n");
+    printf("C: %" PRIu64 "\n", c);
+    printf("B: %" PRIu64 "\n", b);
+    printf("S: %" PRIu64 "\n", s);
+    printf("Replacement policy: %s\n", name);
 }
 
 static void print_statistics(cache_stats_t* p_stats) {
@@ -143,3 +805,9 @@ static void print_statistics(cache_stats_t* p_stats) {
     // Average Access Times
     printf("Average access time (AAT): %f\n", p_stats->avg_access_time);
 }
+
+static void print_miss_classes(const miss_classes_t* classes) {
+    printf("Compulsory misses: %" PRIu64 "\n", classes->compulsory);
+    printf("Capacity misses: %" PRIu64 "\n", classes->capacity);
+    printf("Conflict misses: %" PRIu64 "\n", classes->conflict);
+}
@@ -0,0 +1,328 @@
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include "hier.h"
+#include "policy.h"
+
+#define TRUE 1
+#define FALSE 0
+
+static const char* const inclusion_names[] = {
+    [NON_INCLUSIVE] = "non-inclusive",
+    [INCLUSIVE] = "inclusive",
+    [EXCLUSIVE] = "exclusive",
+};
+
+/**
+ * Sets up one level from a "name C B S policy access_time" line
+ */
+static int load_level(hier_level_t* level, const char* name, uint64_t c, uint64_t b,
+                      uint64_t s, const char* policy, uint64_t access_time)
+{
+    memset(level, 0, sizeof(hier_level_t));
+    snprintf(level->name, sizeof(level->name), "%s", name);
+    level->C = c;
+    level->B = b;
+    level->S = s;
+    if (policy_from_name(policy, &level->policy)) return -1;
+    level->stats.cache_access_time = access_time;
+    level->cache = cache_create(c, b, s, level->policy);
+    return level->cache ? 0 : -1;
+}
+
+/**
+ * Reads a hierarchy description. Each line is one of
+ *
+ *   <name> C B S policy access_time   a cache level
+ *   inclusion <non-inclusive|inclusive|exclusive>
+ *   memory <access_time>
+ *
+ * Levels are listed from the L1 down. A level named L1I serves
+ * instruction fetches; the first other level is the L1D. Blank lines
+ * and everything after a '#' are ignored.
+ *
+ * @param path The path of the hierarchy description
+ * @param hier The hierarchy to set up
+ * @return 0 on success, -1 on failure
+ */
+int hier_load(const char* path, hier_t* hier)
+{
+    FILE* fin = fopen(path, "r");
+    if (!fin) {
+        perror("Unable to open hierarchy description");
+        return -1;
+    }
+
+    memset(hier, 0, sizeof(hier_t));
+    hier->memory_access_time = 120;
+
+    char line[256];
+    unsigned line_no = 0;
+    int ret = 0;
+    while (ret == 0 && fgets(line, sizeof(line), fin)) {
+        line_no++;
+        char* comment = strchr(line, '#');
+        if (comment) *comment = '\0';
+
+        char name[16], policy[16];
+        uint64_t c, b, s, access_time;
+        if (sscanf(line, " %15s", name) != 1) continue;
+
+        if (strcasecmp(name, "inclusion") == 0) {
+            ret = -1;
+            if (sscanf(line, " %*s %15s", policy) == 1) {
+                for (unsigned i = 0; i < sizeof(inclusion_names) / sizeof(inclusion_names[0]); i++) {
+                    if (strcasecmp(policy, inclusion_names[i]) == 0) {
+                        hier->inclusion = (enum INCLUSION) i;
+                        ret = 0;
+                    }
+                }
+            }
+        } else if (strcasecmp(name, "memory") == 0) {
+            ret = sscanf(line, " %*s %" SCNu64, &hier->memory_access_time) == 1 ? 0 : -1;
+        } else if (sscanf(line, " %*s %" SCNu64 " %" SCNu64 " %" SCNu64 " %15s %" SCNu64,
+                          &c, &b, &s, policy, &access_time) != 5) {
+            ret = -1;
+        } else if (strcasecmp(name, "L1I") == 0 && !hier->has_l1i) {
+            ret = load_level(&hier->l1i, name, c, b, s, policy, access_time);
+            hier->has_l1i = ret == 0;
+        } else if (hier->num_levels < HIER_MAX_LEVELS) {
+            ret = load_level(&hier->levels[hier->num_levels], name, c, b, s, policy, access_time);
+            hier->num_levels += ret == 0;
+        } else {
+            ret = -1;
+        }
+    }
+    fclose(fin);
+
+    if (ret) {
+        printf("Invalid hierarchy description on line %u of %s\n", line_no, path);
+    } else if (hier->num_levels == 0) {
+        printf("%s does not describe any cache levels\n", path);
+        ret = -1;
+    } else {
+        // Moving or invalidating blocks between levels needs each level's
+        // blocks to be at least as large as the ones above it, and exactly
+        // as large when blocks move between exclusive levels
+        for (uint64_t i = 1; i < hier->num_levels; i++) {
+            uint64_t above = hier->levels[i - 1].B;
+            uint64_t here = hier->levels[i].B;
+            if (hier->has_l1i && i == 1 && hier->l1i.B > above) above = hier->l1i.B;
+            if (here < above || (hier->inclusion == EXCLUSIVE
+                                 && (here != above || (hier->has_l1i && hier->l1i.B != here)))) {
+                printf("Block size of %s does not fit a %s hierarchy\n",
+                       hier->levels[i].name, inclusion_names[hier->inclusion]);
+                ret = -1;
+            }
+        }
+    }
+
+    if (ret) hier_destroy(hier);
+    return ret;
+}
+
+static void write_back(hier_t* hier, uint64_t i, uint64_t address);
+
+/**
+ * Removes every copy of a level's block from the levels above it, as an
+ * inclusive hierarchy must when the block leaves that level
+ *
+ * @return TRUE if any removed copy was dirty
+ */
+static uint8_t back_invalidate(hier_t* hier, uint64_t i, uint64_t address)
+{
+    hier_level_t* level = &hier->levels[i];
+    uint8_t any_dirty = FALSE;
+
+    for (uint64_t j = 0; j <= i; j++) {
+        hier_level_t* above = j < i ? &hier->levels[j] : &hier->l1i;
+        if (j == i && !hier->has_l1i) break;
+
+        uint64_t step = (uint64_t) 1 << above->B;
+        uint64_t end = address + ((uint64_t) 1 << level->B);
+        for (uint64_t a = address; a < end; a += step) {
+            uint8_t dirty;
+            if (cache_invalidate_h(above->cache, a, &dirty)) {
+                level->back_invalidations++;
+                any_dirty |= dirty;
+            }
+        }
+    }
+    return any_dirty;
+}
+
+/**
+ * Handles a block that was replaced in level i of a non-exclusive
+ * hierarchy. The level's write back counter must already include the
+ * victim if it was dirty there.
+ */
+static void evict(hier_t* hier, uint64_t i, const cache_victim_t* victim)
+{
+    uint8_t dirty = victim->dirty;
+    if (hier->inclusion == INCLUSIVE && i > 0 && back_invalidate(hier, i, victim->address)
+            && !dirty) {
+        // A newer copy from above has to be written back in its place
+        hier->levels[i].stats.write_backs++;
+        dirty = TRUE;
+    }
+    if (dirty) {
+        write_back(hier, i + 1, victim->address);
+    }
+}
+
+/**
+ * Writes a dirty block back into level i, allocating it there if needed
+ */
+static void write_back(hier_t* hier, uint64_t i, uint64_t address)
+{
+    if (i >= hier->num_levels) {
+        hier->memory_writes++;
+        return;
+    }
+
+    hier_level_t* level = &hier->levels[i];
+    cache_victim_t victim;
+    if (!cache_fill_h(level->cache, address, TRUE, &victim) && victim.valid) {
+        if (victim.dirty) level->stats.write_backs++;
+        evict(hier, i, &victim);
+    }
+}
+
+/**
+ * Demand access to level i of a non-exclusive hierarchy: misses fill
+ * the block here and fetch it from the level below
+ */
+static void demand(hier_t* hier, uint64_t i, hier_level_t* level, char rw, uint64_t address)
+{
+    cache_victim_t victim;
+    if (cache_access_victim_h(level->cache, rw, address, &level->stats, &victim)) {
+        return;
+    }
+    if (victim.valid) {
+        evict(hier, i, &victim);
+    }
+    if (i + 1 < hier->num_levels) {
+        demand(hier, i + 1, &hier->levels[i + 1], READ, address);
+    } else {
+        hier->memory_reads++;
+    }
+}
+
+/**
+ * Places a block that left level i - 1 of an exclusive hierarchy in
+ * level i, pushing that level's victim further down
+ */
+static void push_down(hier_t* hier, uint64_t i, const cache_victim_t* block)
+{
+    if (i >= hier->num_levels) {
+        hier->memory_writes += block->dirty;
+        return;
+    }
+
+    hier_level_t* level = &hier->levels[i];
+    cache_victim_t victim;
+    cache_fill_h(level->cache, block->address, block->dirty, &victim);
+    if (victim.valid) {
+        level->stats.write_backs += victim.dirty;
+        push_down(hier, i + 1, &victim);
+    }
+}
+
+/**
+ * Access to an exclusive hierarchy: a block lives in at most one level.
+ * L1 misses move the block up from whichever level holds it, and L1
+ * victims move down into level 1.
+ */
+static void access_exclusive(hier_t* hier, hier_level_t* top, char rw, uint64_t address)
+{
+    cache_victim_t victim;
+    if (cache_access_victim_h(top->cache, rw, address, &top->stats, &victim)) {
+        return;
+    }
+
+    uint8_t found = FALSE;
+    uint8_t dirty = FALSE;
+    for (uint64_t i = 1; i < hier->num_levels && !found; i++) {
+        cache_stats_t* stats = &hier->levels[i].stats;
+        stats->accesses++;
+        stats->reads++;
+        found = cache_invalidate_h(hier->levels[i].cache, address, &dirty);
+        if (!found) {
+            stats->misses++;
+            stats->read_misses++;
+        }
+    }
+    if (!found) {
+        hier->memory_reads++;
+    } else if (dirty) {
+        cache_victim_t none;
+        cache_fill_h(top->cache, address, TRUE, &none);
+    }
+
+    if (victim.valid) {
+        push_down(hier, 1, &victim);
+    }
+}
+
+/**
+ * Simulates one access on the whole hierarchy
+ *
+ * @param hier The hierarchy
+ * @param rw The type of access: READ, WRITE or FETCH
+ * @param address The address that is being accessed
+ */
+void hier_access(hier_t* hier, char rw, uint64_t address)
+{
+    hier_level_t* top = rw == FETCH && hier->has_l1i ? &hier->l1i : &hier->levels[0];
+
+    if (hier->inclusion == EXCLUSIVE) {
+        access_exclusive(hier, top, rw, address);
+    } else {
+        demand(hier, 0, top, rw, address);
+    }
+}
+
+/**
+ * Computes every level's miss rate and AAT, from the bottom up, and the
+ * end to end AAT of the hierarchy
+ */
+void hier_finish(hier_t* hier)
+{
+    double penalty = (double) hier->memory_access_time;
+
+    for (uint64_t i = hier->num_levels; i-- > 0; ) {
+        cache_stats_t* stats = &hier->levels[i].stats;
+        stats->memory_access_time = (uint64_t) (penalty + 0.5);
+        stats->miss_rate = stats->accesses
+            ? (double) stats->misses / (double) stats->accesses
+            : 0.0;
+        stats->avg_access_time = (double) stats->cache_access_time + stats->miss_rate * penalty;
+        if (i > 0) penalty = stats->avg_access_time;
+    }
+
+    const cache_stats_t* l1d = &hier->levels[0].stats;
+    double total = l1d->avg_access_time * (double) l1d->accesses;
+    uint64_t accesses = l1d->accesses;
+    if (hier->has_l1i) {
+        cache_stats_t* l1i = &hier->l1i.stats;
+        l1i->memory_access_time = (uint64_t) (penalty + 0.5);
+        l1i->miss_rate = l1i->accesses ? (double) l1i->misses / (double) l1i->accesses : 0.0;
+        l1i->avg_access_time = (double) l1i->cache_access_time + l1i->miss_rate * penalty;
+        total += l1i->avg_access_time * (double) l1i->accesses;
+        accesses += l1i->accesses;
+    }
+    hier->avg_access_time = accesses ? total / (double) accesses : 0.0;
+}
+
+/**
+ * Frees every cache of a hierarchy
+ */
+void hier_destroy(hier_t* hier)
+{
+    for (uint64_t i = 0; i < HIER_MAX_LEVELS; i++) {
+        cache_destroy(hier->levels[i].cache);
+        hier->levels[i].cache = NULL;
+    }
+    cache_destroy(hier->l1i.cache);
+    hier->l1i.cache = NULL;
+}
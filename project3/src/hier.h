@@ -0,0 +1,52 @@
+#ifndef HIER_H
+#define HIER_H
+
+#include "cachesim.h"
+
+// Most levels a hierarchy can have below the L1 (L1I/L1D count as one)
+#define HIER_MAX_LEVELS 4
+
+enum INCLUSION { NON_INCLUSIVE = 0, INCLUSIVE = 1, EXCLUSIVE = 2 };
+
+/**
+ * One cache of a hierarchy and its statistics. For each level, stats
+ * counts the demand accesses that reach it; cache_access_time is the
+ * level's hit time and memory_access_time the average time to service
+ * its misses from the levels below.
+ */
+typedef struct hier_level {
+    char name[8];
+    uint64_t C;
+    uint64_t B;
+    uint64_t S;
+    enum REPLACEMENT_POLICY policy;
+
+    cache_t* cache;
+    cache_stats_t stats;
+    uint64_t back_invalidations;    // Inclusive: blocks removed from levels above
+} hier_level_t;
+
+/**
+ * A chain of caches. Level 0 is the L1D, optionally with a separate
+ * L1I (has_l1i) that serves instruction fetches; both feed level 1.
+ */
+typedef struct hier {
+    enum INCLUSION inclusion;
+    uint64_t memory_access_time;
+
+    hier_level_t levels[HIER_MAX_LEVELS];
+    uint64_t num_levels;
+    hier_level_t l1i;
+    uint8_t has_l1i;
+
+    uint64_t memory_reads;
+    uint64_t memory_writes;
+    double avg_access_time;         // End to end, over all accesses
+} hier_t;
+
+int hier_load(const char* path, hier_t* hier);
+void hier_access(hier_t* hier, char rw, uint64_t address);
+void hier_finish(hier_t* hier);
+void hier_destroy(hier_t* hier);
+
+#endif
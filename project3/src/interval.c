@@ -0,0 +1,85 @@
+#include <string.h>
+#include "interval.h"
+
+/**
+ * Starts a time series. Paths ending in ".json" get a JSON array of
+ * objects, anything else CSV with a header row.
+ *
+ * @param log The time series to initialize
+ * @param path The path of the file to write
+ * @param start The statistics the first interval is measured from
+ * @return 0 on success, -1 on failure
+ */
+int interval_open(interval_log_t* log, const char* path, const cache_stats_t* start)
+{
+    memset(log, 0, sizeof(interval_log_t));
+    log->fout = fopen(path, "w");
+    if (!log->fout) return -1;
+
+    size_t len = strlen(path);
+    log->format = len >= 5 && strcmp(path + len - 5, ".json") == 0 ? INTERVAL_JSON : INTERVAL_CSV;
+    log->last = *start;
+
+    if (log->format == INTERVAL_JSON) {
+        fprintf(log->fout, "[");
+    } else {
+        fprintf(log->fout, "interval,end,accesses,reads,read_misses,writes,write_misses,"
+                "misses,write_backs,miss_rate,avg_access_time\n");
+    }
+    return 0;
+}
+
+/**
+ * Records the interval that ends here, unless no access was counted
+ * since the previous one
+ *
+ * @param log The time series
+ * @param position The number of accesses simulated so far, warmup included
+ * @param stats The running totals
+ */
+void interval_record(interval_log_t* log, uint64_t position, const cache_stats_t* stats)
+{
+    cache_stats_t delta = *stats;
+    delta.accesses -= log->last.accesses;
+    delta.reads -= log->last.reads;
+    delta.read_misses -= log->last.read_misses;
+    delta.writes -= log->last.writes;
+    delta.write_misses -= log->last.write_misses;
+    delta.misses -= log->last.misses;
+    delta.write_backs -= log->last.write_backs;
+    if (delta.accesses == 0) return;
+    cache_compute_stats(&delta);
+    log->last = *stats;
+
+    if (log->format == INTERVAL_JSON) {
+        fprintf(log->fout, "%s\n  {\"interval\": %" PRIu64 ", \"end\": %" PRIu64
+                ", \"accesses\": %" PRIu64 ", \"reads\": %" PRIu64 ", \"read_misses\": %" PRIu64
+                ", \"writes\": %" PRIu64 ", \"write_misses\": %" PRIu64 ", \"misses\": %" PRIu64
+                ", \"write_backs\": %" PRIu64 ", \"miss_rate\": %f, \"avg_access_time\": %f}",
+                log->count ? "," : "", log->count, position, delta.accesses, delta.reads,
+                delta.read_misses, delta.writes, delta.write_misses, delta.misses,
+                delta.write_backs, delta.miss_rate, delta.avg_access_time);
+    } else {
+        fprintf(log->fout, "%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64
+                ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%f,%f\n",
+                log->count, position, delta.accesses, delta.reads, delta.read_misses,
+                delta.writes, delta.write_misses, delta.misses, delta.write_backs,
+                delta.miss_rate, delta.avg_access_time);
+    }
+    log->count++;
+}
+
+/**
+ * Finishes and closes a time series
+ *
+ * @return 0 on success, -1 on failure
+ */
+int interval_close(interval_log_t* log)
+{
+    if (log->format == INTERVAL_JSON) {
+        fprintf(log->fout, "\n]\n");
+    }
+    int ret = fclose(log->fout) ? -1 : 0;
+    log->fout = NULL;
+    return ret;
+}
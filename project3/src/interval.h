@@ -0,0 +1,25 @@
+#ifndef INTERVAL_H
+#define INTERVAL_H
+
+#include <stdio.h>
+#include "cachesim.h"
+
+enum INTERVAL_FORMAT { INTERVAL_CSV = 0, INTERVAL_JSON = 1 };
+
+/**
+ * A time series of statistics, one record per interval of accesses.
+ * Each record holds the counters accumulated since the previous one
+ * and the miss rate and AAT of just that interval.
+ */
+typedef struct interval_log {
+    FILE* fout;
+    enum INTERVAL_FORMAT format;
+    uint64_t count;         // Records written so far
+    cache_stats_t last;     // Totals at the end of the previous interval
+} interval_log_t;
+
+int interval_open(interval_log_t* log, const char* path, const cache_stats_t* start);
+void interval_record(interval_log_t* log, uint64_t position, const cache_stats_t* stats);
+int interval_close(interval_log_t* log);
+
+#endif
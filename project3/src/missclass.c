@@ -0,0 +1,292 @@
+#include <stdio.h>
+#include <string.h>
+#include "missclass.h"
+
+#define TRUE 1
+#define FALSE 0
+
+// Multiplicative hashing constant for block addresses
+#define HASH_MULT 0x9e3779b97f4a7c15ULL
+// Initial size of the first-touch set, as a power of two
+#define SEEN_BITS 16
+// Marks the end of the shadow LRU list
+#define NIL UINT32_MAX
+// Accesses ahead whose shadow table slot is prefetched
+#define PREFETCH_AHEAD 8
+
+typedef struct shadow_entry {
+    uint64_t block;         // Block address + 1, or 0 if the entry is empty
+    uint32_t slot;
+} shadow_entry_t;
+
+struct missclass {
+    uint64_t block_shift;
+    uint64_t index_mask;
+    uint64_t num_sets;
+
+    /*
+     * Shadow fully associative LRU cache with as many blocks as the
+     * real one: a recency list threaded through the block slots, and an
+     * open-addressed table from block address to slot. Each slot knows
+     * its table position, so evicting never has to probe.
+     */
+    uint64_t capacity;
+    uint64_t used;
+    uint32_t* prev;
+    uint32_t* next;
+    uint32_t* position;
+    uint32_t head;
+    uint32_t tail;
+    shadow_entry_t* table;
+    uint64_t table_bits;
+
+    // Every block address ever missed on, stored as address + 1
+    uint64_t* seen;
+    uint64_t seen_bits;
+    uint64_t seen_count;
+
+    uint64_t* set_accesses;
+    uint64_t* set_misses;
+    uint64_t* set_conflicts;
+};
+
+static uint64_t hash(uint64_t block, uint64_t bits)
+{
+    return (block * HASH_MULT) >> (64 - bits);
+}
+
+/**
+ * Creates the classifier for a cache of the given geometry
+ *
+ * @return The classifier, or NULL if the configuration is invalid or
+ *         memory could not be allocated
+ */
+missclass_t* missclass_create(uint64_t C, uint64_t B, uint64_t S)
+{
+    if (C >= 32 + B || C < B + S) return NULL;
+
+    missclass_t* mc = calloc(1, sizeof(missclass_t));
+    if (!mc) return NULL;
+    mc->block_shift = B;
+    mc->num_sets = (uint64_t) 1 << (C - B - S);
+    mc->index_mask = mc->num_sets - 1;
+    mc->capacity = (uint64_t) 1 << (C - B);
+    mc->head = mc->tail = NIL;
+    mc->table_bits = C - B + 1;
+    mc->seen_bits = SEEN_BITS;
+
+    mc->prev = malloc(mc->capacity * sizeof(uint32_t));
+    mc->next = malloc(mc->capacity * sizeof(uint32_t));
+    mc->position = malloc(mc->capacity * sizeof(uint32_t));
+    mc->table = calloc((size_t) 1 << mc->table_bits, sizeof(shadow_entry_t));
+    mc->seen = calloc((size_t) 1 << mc->seen_bits, sizeof(uint64_t));
+    mc->set_accesses = calloc(mc->num_sets, sizeof(uint64_t));
+    mc->set_misses = calloc(mc->num_sets, sizeof(uint64_t));
+    mc->set_conflicts = calloc(mc->num_sets, sizeof(uint64_t));
+    if (!mc->prev || !mc->next || !mc->position || !mc->table || !mc->seen
+            || !mc->set_accesses || !mc->set_misses || !mc->set_conflicts) {
+        missclass_destroy(mc);
+        return NULL;
+    }
+    return mc;
+}
+
+/**
+ * Removes an entry from the shadow table, shifting later entries of its
+ * probe run back so lookups never stop early at the hole
+ *
+ * @return The position left empty
+ */
+static uint64_t table_remove(missclass_t* mc, uint64_t pos)
+{
+    uint64_t mask = ((uint64_t) 1 << mc->table_bits) - 1;
+    uint64_t hole = pos;
+    uint64_t j = pos;
+
+    for (;;) {
+        j = (j + 1) & mask;
+        shadow_entry_t entry = mc->table[j];
+        if (!entry.block) break;
+
+        // Entries whose home lies cyclically in (hole, j] stay put
+        uint64_t home = hash(entry.block - 1, mc->table_bits);
+        uint8_t stays = hole <= j ? (hole < home && home <= j) : (hole < home || home <= j);
+        if (!stays) {
+            mc->table[hole] = entry;
+            mc->position[entry.slot] = (uint32_t) hole;
+            hole = j;
+        }
+    }
+    mc->table[hole].block = 0;
+    return hole;
+}
+
+static void list_unlink(missclass_t* mc, uint32_t slot)
+{
+    if (mc->prev[slot] != NIL) mc->next[mc->prev[slot]] = mc->next[slot];
+    else mc->head = mc->next[slot];
+    if (mc->next[slot] != NIL) mc->prev[mc->next[slot]] = mc->prev[slot];
+    else mc->tail = mc->prev[slot];
+}
+
+static void list_push_front(missclass_t* mc, uint32_t slot)
+{
+    mc->prev[slot] = NIL;
+    mc->next[slot] = mc->head;
+    if (mc->head != NIL) mc->prev[mc->head] = slot;
+    else mc->tail = slot;
+    mc->head = slot;
+}
+
+/**
+ * Accesses a block in the shadow fully associative LRU cache
+ *
+ * @return TRUE on a hit
+ */
+static uint8_t shadow_access(missclass_t* mc, uint64_t block)
+{
+    uint64_t mask = ((uint64_t) 1 << mc->table_bits) - 1;
+    uint64_t pos = hash(block, mc->table_bits);
+
+    for (; mc->table[pos].block; pos = (pos + 1) & mask) {
+        if (mc->table[pos].block == block + 1) {
+            uint32_t slot = mc->table[pos].slot;
+            if (mc->head != slot) {
+                list_unlink(mc, slot);
+                list_push_front(mc, slot);
+            }
+            return TRUE;
+        }
+    }
+
+    uint32_t slot;
+    if (mc->used < mc->capacity) {
+        slot = (uint32_t) mc->used++;
+    } else {
+        // Evict the least recently used block
+        slot = mc->tail;
+        uint64_t hole = table_remove(mc, mc->position[slot]);
+        list_unlink(mc, slot);
+
+        // The probe run [home, pos) was full, so if the hole left behind
+        // is in it, it is now the first free position of the run
+        uint64_t home = hash(block, mc->table_bits);
+        if (((hole - home) & mask) < ((pos - home) & mask)) pos = hole;
+    }
+    mc->table[pos].block = block + 1;
+    mc->table[pos].slot = slot;
+    mc->position[slot] = (uint32_t) pos;
+    list_push_front(mc, slot);
+    return FALSE;
+}
+
+/**
+ * Adds a block to the first-touch set
+ *
+ * @return TRUE if the block had never been seen before
+ */
+static uint8_t first_touch(missclass_t* mc, uint64_t block)
+{
+    if (2 * (mc->seen_count + 1) > ((uint64_t) 1 << mc->seen_bits)) {
+        // Rehash into a table twice the size
+        uint64_t old_size = (uint64_t) 1 << mc->seen_bits;
+        uint64_t* grown = calloc(2 * old_size, sizeof(uint64_t));
+        if (grown) {
+            uint64_t bits = mc->seen_bits + 1;
+            uint64_t mask = 2 * old_size - 1;
+            for (uint64_t i = 0; i < old_size; i++) {
+                if (!mc->seen[i]) continue;
+                uint64_t pos = hash(mc->seen[i] - 1, bits);
+                while (grown[pos]) pos = (pos + 1) & mask;
+                grown[pos] = mc->seen[i];
+            }
+            free(mc->seen);
+            mc->seen = grown;
+            mc->seen_bits = bits;
+        }
+    }
+
+    uint64_t mask = ((uint64_t) 1 << mc->seen_bits) - 1;
+    uint64_t pos = hash(block, mc->seen_bits);
+    for (; mc->seen[pos]; pos = (pos + 1) & mask) {
+        if (mc->seen[pos] == block + 1) return FALSE;
+    }
+    if (mc->seen_count < mask) {
+        // Out of memory to grow: keep going, at the cost of a full table
+        mc->seen[pos] = block + 1;
+        mc->seen_count++;
+    }
+    return TRUE;
+}
+
+/**
+ * Classifies the misses of a batch of accesses that was just simulated
+ *
+ * @param mc The classifier
+ * @param addresses The addresses accessed, in order
+ * @param hits Whether each access hit in the real cache
+ * @param n The number of accesses
+ * @param classes Incremented by the misses of each class
+ */
+void missclass_batch(missclass_t* mc, const uint64_t* addresses, const uint8_t* hits,
+                     size_t n, miss_classes_t* classes)
+{
+    for (size_t i = 0; i < n; i++) {
+        if (i + PREFETCH_AHEAD < n) {
+            uint64_t ahead = addresses[i + PREFETCH_AHEAD] >> mc->block_shift;
+            __builtin_prefetch(&mc->table[hash(ahead, mc->table_bits)]);
+        }
+        uint64_t block = addresses[i] >> mc->block_shift;
+        uint64_t index = block & mc->index_mask;
+        uint8_t shadow_hit = shadow_access(mc, block);
+
+        mc->set_accesses[index]++;
+        if (hits[i]) continue;
+
+        mc->set_misses[index]++;
+        if (first_touch(mc, block)) {
+            classes->compulsory++;
+        } else if (!shadow_hit) {
+            classes->capacity++;
+        } else {
+            classes->conflict++;
+            mc->set_conflicts[index]++;
+        }
+    }
+}
+
+/**
+ * Writes the per-set heatmap as CSV: one "set,accesses,misses,conflicts"
+ * row per set
+ *
+ * @return 0 on success, -1 on failure
+ */
+int missclass_write_heatmap(const missclass_t* mc, const char* path)
+{
+    FILE* fout = fopen(path, "w");
+    if (!fout) return -1;
+
+    fprintf(fout, "set,accesses,misses,conflicts\n");
+    for (uint64_t set = 0; set < mc->num_sets; set++) {
+        fprintf(fout, "%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 "\n",
+                set, mc->set_accesses[set], mc->set_misses[set], mc->set_conflicts[set]);
+    }
+    return fclose(fout) ? -1 : 0;
+}
+
+/**
+ * Frees a classifier
+ */
+void missclass_destroy(missclass_t* mc)
+{
+    if (!mc) return;
+    free(mc->prev);
+    free(mc->next);
+    free(mc->position);
+    free(mc->table);
+    free(mc->seen);
+    free(mc->set_accesses);
+    free(mc->set_misses);
+    free(mc->set_conflicts);
+    free(mc);
+}
@@ -0,0 +1,28 @@
+#ifndef MISSCLASS_H
+#define MISSCLASS_H
+
+#include "cachesim.h"
+
+/*
+ * 3C miss classification. Every miss of the simulated cache is
+ * compulsory if its block was never referenced before, a capacity miss
+ * if a fully associative LRU cache of the same size would also have
+ * missed, and a conflict miss otherwise. Misses are also counted per
+ * set for a heatmap of where the conflicts are.
+ */
+
+typedef struct miss_classes {
+    uint64_t compulsory;
+    uint64_t capacity;
+    uint64_t conflict;
+} miss_classes_t;
+
+typedef struct missclass missclass_t;
+
+missclass_t* missclass_create(uint64_t C, uint64_t B, uint64_t S);
+void missclass_batch(missclass_t* mc, const uint64_t* addresses, const uint8_t* hits,
+                     size_t n, miss_classes_t* classes);
+int missclass_write_heatmap(const missclass_t* mc, const char* path);
+void missclass_destroy(missclass_t* mc);
+
+#endif
@@ -0,0 +1,149 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "output.h"
+
+#define TRUE 1
+#define FALSE 0
+
+/**
+ * Writes all of a buffer, remembering the first error
+ */
+static void write_all(output_t* out, const char* data, size_t size)
+{
+    while (size && !out->error) {
+        ssize_t written = write(out->fd, data, size);
+        if (written < 0) {
+            if (errno != EINTR) out->error = errno;
+            continue;
+        }
+        data += written;
+        size -= (size_t) written;
+    }
+}
+
+/**
+ * Writer thread: writes each buffer handed over by output_swap until
+ * output_close stops it
+ */
+static void* output_writer(void* arg)
+{
+    output_t* out = arg;
+
+    pthread_mutex_lock(&out->lock);
+    for (;;) {
+        while (!out->pending && !out->stop) {
+            pthread_cond_wait(&out->work, &out->lock);
+        }
+        if (!out->pending) break;
+
+        const char* data = out->pending;
+        size_t size = out->pending_size;
+        pthread_mutex_unlock(&out->lock);
+        write_all(out, data, size);
+        pthread_mutex_lock(&out->lock);
+
+        out->pending = NULL;
+        pthread_cond_signal(&out->idle);
+    }
+    pthread_mutex_unlock(&out->lock);
+    return NULL;
+}
+
+/**
+ * Starts writing per-access results to a file descriptor. Anything
+ * still buffered by stdio is flushed first so that it comes out before
+ * the results.
+ *
+ * @param out The output to initialize
+ * @param fd The file descriptor to write to; it is not closed
+ * @param format Text lines as printed by -p, or binary records
+ * @param threaded TRUE to write from a background thread
+ * @return 0 on success, -1 on failure
+ */
+int output_open(output_t* out, int fd, enum OUTPUT_FORMAT format, uint8_t threaded)
+{
+    memset(out, 0, sizeof(output_t));
+    out->fd = fd;
+    out->format = format;
+    out->buffers[0] = malloc(2 * (size_t) OUTPUT_BUFFER);
+    if (!out->buffers[0]) return -1;
+    out->buffers[1] = out->buffers[0] + OUTPUT_BUFFER;
+    out->buffer = out->buffers[0];
+
+    fflush(NULL);
+    if (format == OUTPUT_BINARY) {
+        memcpy(out->buffer, OUTPUT_MAGIC, OUTPUT_MAGIC_LEN);
+        out->used = OUTPUT_MAGIC_LEN;
+    }
+
+    if (threaded) {
+        pthread_mutex_init(&out->lock, NULL);
+        pthread_cond_init(&out->work, NULL);
+        pthread_cond_init(&out->idle, NULL);
+        out->threaded = pthread_create(&out->writer, NULL, output_writer, out) == 0;
+        if (!out->threaded) {
+            pthread_cond_destroy(&out->idle);
+            pthread_cond_destroy(&out->work);
+            pthread_mutex_destroy(&out->lock);
+        }
+    }
+    return 0;
+}
+
+/**
+ * Writes out the current buffer and starts filling an empty one. With
+ * a writer thread this only waits for the thread to finish with the
+ * other buffer.
+ */
+void output_swap(output_t* out)
+{
+    if (!out->threaded) {
+        write_all(out, out->buffer, out->used);
+        out->used = 0;
+        return;
+    }
+
+    pthread_mutex_lock(&out->lock);
+    while (out->pending) {
+        pthread_cond_wait(&out->idle, &out->lock);
+    }
+    out->pending = out->buffer;
+    out->pending_size = out->used;
+    pthread_cond_signal(&out->work);
+    pthread_mutex_unlock(&out->lock);
+
+    out->buffer = out->buffer == out->buffers[0] ? out->buffers[1] : out->buffers[0];
+    out->used = 0;
+}
+
+/**
+ * Writes out everything still buffered, stops the writer thread and
+ * frees the buffers. The file descriptor is left open.
+ *
+ * @return 0 if every result was written, -1 otherwise with errno set
+ */
+int output_close(output_t* out)
+{
+    output_swap(out);
+    if (out->threaded) {
+        pthread_mutex_lock(&out->lock);
+        out->stop = TRUE;
+        pthread_cond_signal(&out->work);
+        pthread_mutex_unlock(&out->lock);
+        pthread_join(out->writer, NULL);
+        pthread_cond_destroy(&out->idle);
+        pthread_cond_destroy(&out->work);
+        pthread_mutex_destroy(&out->lock);
+    }
+    free(out->buffers[0]);
+
+    int error = out->error;
+    memset(out, 0, sizeof(output_t));
+    if (error) {
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
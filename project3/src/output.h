@@ -0,0 +1,118 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <string.h>
+
+// Bytes per output buffer; there are two so one can be written while the other fills
+#define OUTPUT_BUFFER (1 << 20)
+// Room always left in the current buffer for one more access
+#define OUTPUT_MAX_RECORD 80
+
+/*
+ * Binary result format
+ *
+ * A binary result stream starts with the 8 bytes of OUTPUT_MAGIC,
+ * followed by one output_record_t of three 64-bit words per access until
+ * the end of the file. It holds the same fields as a -p line, so two runs
+ * can be compared with cmp instead of diff. The words are in the byte
+ * order of the machine that wrote them, so results are not portable
+ * between little and big endian hosts.
+ */
+#define OUTPUT_MAGIC "CSIMRES1"
+#define OUTPUT_MAGIC_LEN 8
+
+// Set in output_record_t.index for a hit
+#define OUTPUT_HIT_BIT ((uint64_t) 1 << 63)
+
+typedef struct output_record {
+    uint64_t address;
+    uint64_t tag;
+    uint64_t index;         // Index, with OUTPUT_HIT_BIT set for a hit
+} output_record_t;
+
+enum OUTPUT_FORMAT { OUTPUT_TEXT = 0, OUTPUT_BINARY = 1 };
+
+/**
+ * Writes the per-access results of a simulation. Accesses are formatted
+ * straight into a large buffer which is handed to write(2) when full,
+ * either directly or by a background thread that writes one buffer
+ * while the simulation fills the other.
+ */
+typedef struct output {
+    int fd;
+    enum OUTPUT_FORMAT format;
+    char* buffers[2];
+    char* buffer;           // The buffer being filled, one of buffers
+    size_t used;
+    int error;              // errno of the first failed write, or 0
+
+    uint8_t threaded;
+    const char* pending;    // Handed to the writer thread, or NULL
+    size_t pending_size;
+    uint8_t stop;
+    pthread_t writer;
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t idle;
+} output_t;
+
+int output_open(output_t* out, int fd, enum OUTPUT_FORMAT format, uint8_t threaded);
+void output_swap(output_t* out);
+int output_close(output_t* out);
+
+/**
+ * Formats a value as "0x" and at least 12 hex digits, like "0x%012" PRIx64
+ *
+ * @return The end of the formatted value
+ */
+static inline char* output_hex(char* p, uint64_t value)
+{
+    static const char digits[] = "0123456789abcdef";
+    unsigned n = value >> 48 ? 16 - (unsigned) __builtin_clzll(value) / 4 : 12;
+
+    p[0] = '0';
+    p[1] = 'x';
+    p += 2;
+    for (unsigned i = n; i-- > 0; ) {
+        p[i] = digits[value & 15];
+        value >>= 4;
+    }
+    return p + n;
+}
+
+/**
+ * Writes the result of one access, as a -p line or a binary record
+ *
+ * @param out The output
+ * @param address The address that was accessed
+ * @param hit Nonzero if the access hit
+ * @param tag The tag of the address
+ * @param index The index of the address
+ */
+static inline void output_access(output_t* out, uint64_t address, uint8_t hit,
+                                 uint64_t tag, uint64_t index)
+{
+    char* p = out->buffer + out->used;
+
+    if (out->format == OUTPUT_BINARY) {
+        output_record_t record = { address, tag, index | (hit ? OUTPUT_HIT_BIT : 0) };
+        memcpy(p, &record, sizeof(record));
+        p += sizeof(record);
+    } else {
+        p = output_hex(p, address);
+        memcpy(p, hit ? "\thit \t" : "\tmiss\t", 6);
+        p = output_hex(p + 6, tag);
+        *p++ = '\t';
+        p = output_hex(p, index);
+        *p++ = '\n';
+    }
+
+    out->used = (size_t) (p - out->buffer);
+    if (out->used > OUTPUT_BUFFER - OUTPUT_MAX_RECORD) {
+        output_swap(out);
+    }
+}
+
+#endif
@@ -0,0 +1,257 @@
+#include <string.h>
+#include <strings.h>
+#include "policy.h"
+
+// Seed for the random and BRRIP policies, fixed so runs are repeatable
+#define POLICY_SEED 0x2545f4914f6cdd1dULL
+// BRRIP inserts at the long re-reference interval except 1 in this many fills
+#define BRRIP_EPSILON 32
+// Re-reference prediction values are 2 bits wide
+#define RRPV_LEVELS 4
+
+static uint64_t words_for(uint64_t ways)
+{
+    return (ways + 63) / 64;
+}
+
+/**
+ * xorshift64* step, used wherever a policy needs randomness
+ */
+static uint64_t next_random(uint64_t* seed)
+{
+    uint64_t x = *seed;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *seed = x;
+    return (x * 0x2545f4914f6cdd1dULL) >> 32;
+}
+
+static void no_init(void* state, uint64_t num_sets, uint64_t ways)
+{
+    (void) state;
+    (void) num_sets;
+    (void) ways;
+}
+
+static void no_update(void* state, uint64_t set, uint64_t way, uint64_t ways)
+{
+    (void) state;
+    (void) set;
+    (void) way;
+    (void) ways;
+}
+
+/*
+ * LRU and FIFO: see policy_lru_touch in policy.h.
+ */
+
+static size_t lru_state_size(uint64_t num_sets, uint64_t ways)
+{
+    return num_sets * (ways + 1) * sizeof(lru_link_t);
+}
+
+static void lru_init(void* state, uint64_t num_sets, uint64_t ways)
+{
+    for (uint64_t set = 0; set < num_sets; set++) {
+        lru_link_t* list = (lru_link_t*) state + set * (ways + 1);
+        lru_link_t* links = list + 1;
+        list->prev = 0;
+        list->next = (uint16_t) (ways - 1);
+        for (uint64_t way = 0; way < ways; way++) {
+            links[way].prev = (uint16_t) (way - 1);
+            links[way].next = (uint16_t) (way + 1);
+        }
+    }
+}
+
+/*
+ * Tree-PLRU: ways - 1 direction bits per set, stored in heap order in a
+ * per-set bitmap (bit n for node n, root at 1). A set bit means the
+ * victim lies in the right subtree. Hits and fills point every node on
+ * the path away from the touched way.
+ */
+
+static size_t plru_state_size(uint64_t num_sets, uint64_t ways)
+{
+    return num_sets * words_for(ways) * sizeof(uint64_t);
+}
+
+static void plru_touch(void* state, uint64_t set, uint64_t way, uint64_t ways)
+{
+    uint64_t* bits = (uint64_t*) state + set * words_for(ways);
+
+    for (uint64_t node = way + ways; node > 1; node /= 2) {
+        uint64_t parent = node / 2;
+        uint64_t mask = (uint64_t) 1 << (parent % 64);
+        if (node & 1) {
+            bits[parent / 64] &= ~mask;
+        } else {
+            bits[parent / 64] |= mask;
+        }
+    }
+}
+
+static uint64_t plru_victim(void* state, uint64_t set, uint64_t ways)
+{
+    const uint64_t* bits = (const uint64_t*) state + set * words_for(ways);
+
+    uint64_t node = 1;
+    while (node < ways) {
+        node = 2 * node + ((bits[node / 64] >> (node % 64)) & 1);
+    }
+    return node - ways;
+}
+
+/*
+ * SRRIP and BRRIP: a 2-bit re-reference prediction value per way, kept
+ * as one way bitmap per value so that finding a distant (RRPV 3) way
+ * and aging the whole set are word operations. Hits predict a near
+ * re-reference (0); SRRIP fills at 2 and BRRIP fills mostly at 3.
+ */
+
+typedef struct rrip_state {
+    uint64_t seed;
+    uint64_t words;         // Words per way bitmap
+    uint64_t levels[];      // Per set, RRPV_LEVELS bitmaps of words each
+} rrip_state_t;
+
+static size_t rrip_state_size(uint64_t num_sets, uint64_t ways)
+{
+    return sizeof(rrip_state_t) + num_sets * RRPV_LEVELS * words_for(ways) * sizeof(uint64_t);
+}
+
+static void rrip_init(void* state, uint64_t num_sets, uint64_t ways)
+{
+    (void) num_sets;
+    rrip_state_t* rrip = state;
+    rrip->seed = POLICY_SEED;
+    rrip->words = words_for(ways);
+}
+
+/**
+ * Moves a way to the given RRPV
+ */
+static void rrip_set(rrip_state_t* rrip, uint64_t set, uint64_t way, unsigned rrpv)
+{
+    uint64_t* levels = &rrip->levels[set * RRPV_LEVELS * rrip->words];
+    uint64_t word = way / 64;
+    uint64_t mask = (uint64_t) 1 << (way % 64);
+
+    for (unsigned level = 0; level < RRPV_LEVELS; level++) {
+        levels[level * rrip->words + word] &= ~mask;
+    }
+    levels[rrpv * rrip->words + word] |= mask;
+}
+
+static void rrip_hit(void* state, uint64_t set, uint64_t way, uint64_t ways)
+{
+    (void) ways;
+    rrip_set(state, set, way, 0);
+}
+
+static void srrip_fill(void* state, uint64_t set, uint64_t way, uint64_t ways)
+{
+    (void) ways;
+    rrip_set(state, set, way, RRPV_LEVELS - 2);
+}
+
+static void brrip_fill(void* state, uint64_t set, uint64_t way, uint64_t ways)
+{
+    (void) ways;
+    rrip_state_t* rrip = state;
+    unsigned rrpv = next_random(&rrip->seed) % BRRIP_EPSILON ? RRPV_LEVELS - 1 : RRPV_LEVELS - 2;
+    rrip_set(rrip, set, way, rrpv);
+}
+
+static uint64_t rrip_victim(void* state, uint64_t set, uint64_t ways)
+{
+    (void) ways;
+    rrip_state_t* rrip = state;
+    uint64_t words = rrip->words;
+    uint64_t* levels = &rrip->levels[set * RRPV_LEVELS * words];
+    uint64_t* distant = &levels[(RRPV_LEVELS - 1) * words];
+
+    for (;;) {
+        for (uint64_t w = 0; w < words; w++) {
+            if (distant[w]) return w * 64 + (uint64_t) __builtin_ctzll(distant[w]);
+        }
+
+        // No way at the distant RRPV: age every way by one
+        for (unsigned level = RRPV_LEVELS - 1; level > 0; level--) {
+            memcpy(&levels[level * words], &levels[(level - 1) * words], words * sizeof(uint64_t));
+        }
+        memset(levels, 0, words * sizeof(uint64_t));
+    }
+}
+
+/*
+ * Random: a uniformly random way of the set.
+ */
+
+static size_t random_state_size(uint64_t num_sets, uint64_t ways)
+{
+    (void) num_sets;
+    (void) ways;
+    return sizeof(uint64_t);
+}
+
+static void random_init(void* state, uint64_t num_sets, uint64_t ways)
+{
+    (void) num_sets;
+    (void) ways;
+    *(uint64_t*) state = POLICY_SEED;
+}
+
+static uint64_t random_victim(void* state, uint64_t set, uint64_t ways)
+{
+    (void) set;
+    return next_random(state) & (ways - 1);
+}
+
+static const policy_t policies[] = {
+    [FIFO] = { "FIFO", lru_state_size, lru_init, no_update, policy_lru_touch, policy_lru_victim },
+    [LRU] = { "LRU", lru_state_size, lru_init, policy_lru_touch, policy_lru_touch,
+              policy_lru_victim },
+    [PLRU] = { "PLRU", plru_state_size, no_init, plru_touch, plru_touch, plru_victim },
+    [SRRIP] = { "SRRIP", rrip_state_size, rrip_init, rrip_hit, srrip_fill, rrip_victim },
+    [BRRIP] = { "BRRIP", rrip_state_size, rrip_init, rrip_hit, brrip_fill, rrip_victim },
+    [RANDOM] = { "RANDOM", random_state_size, random_init, no_update, no_update, random_victim },
+};
+
+#define NUM_POLICIES (sizeof(policies) / sizeof(policies[0]))
+
+/**
+ * Returns the implementation of a replacement policy, or NULL if there
+ * is none
+ */
+const policy_t* policy_get(enum REPLACEMENT_POLICY policy)
+{
+    if ((unsigned) policy >= NUM_POLICIES) return NULL;
+    return &policies[policy];
+}
+
+/**
+ * Looks up a replacement policy by its name, ignoring case
+ *
+ * @return 0 on success, -1 if there is no policy with that name
+ */
+int policy_from_name(const char* name, enum REPLACEMENT_POLICY* policy)
+{
+    for (unsigned i = 0; i < NUM_POLICIES; i++) {
+        if (strcasecmp(name, policies[i].name) == 0) {
+            *policy = (enum REPLACEMENT_POLICY) i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Returns the name of a replacement policy
+ */
+const char* policy_name(enum REPLACEMENT_POLICY policy)
+{
+    const policy_t* impl = policy_get(policy);
+    return impl ? impl->name : "UNKNOWN";
+}
@@ -0,0 +1,77 @@
+#ifndef POLICY_H
+#define POLICY_H
+
+#include "cachesim.h"
+
+/**
+ * A replacement policy. Each cache owns a block of policy state sized
+ * by state_size and laid out however the policy likes; the cache calls
+ * back into the policy on every hit and fill, and asks it for a victim
+ * only when a set has no invalid way left.
+ */
+typedef struct policy {
+    const char* name;
+
+    // Bytes of state needed for a cache of this geometry
+    size_t (*state_size)(uint64_t num_sets, uint64_t ways);
+    // Sets up zeroed state
+    void (*init)(void* state, uint64_t num_sets, uint64_t ways);
+
+    void (*hit)(void* state, uint64_t set, uint64_t way, uint64_t ways);
+    void (*fill)(void* state, uint64_t set, uint64_t way, uint64_t ways);
+    uint64_t (*victim)(void* state, uint64_t set, uint64_t ways);
+} policy_t;
+
+/*
+ * LRU: an intrusive doubly linked recency list per set, threaded
+ * through 16-bit way numbers. Hits and fills move a way to the head and
+ * the victim is the tail, all in O(1). Each set's list header is
+ * followed by its ways' links.
+ *
+ * FIFO: the same list, but only fills move a way to the head, so the
+ * tail is the way filled longest ago. A way that is invalidated and
+ * refilled goes back to the head, which a round-robin pointer would get
+ * wrong.
+ *
+ * Their hot paths live here so that the specialized kernels in
+ * cachesim.c can inline them with a constant number of ways.
+ */
+
+typedef struct lru_link {
+    uint16_t prev;          // In a list header: the most recently used way
+    uint16_t next;          // In a list header: the least recently used way
+} lru_link_t;
+
+static inline void policy_lru_touch(void* state, uint64_t set, uint64_t way, uint64_t ways)
+{
+    lru_link_t* list = (lru_link_t*) state + set * (ways + 1);
+    lru_link_t* links = list + 1;
+    uint16_t head = list->prev;
+    if (head == way) return;
+
+    // Unlink the way; it is not the head, so it has a predecessor
+    uint16_t prev = links[way].prev;
+    uint16_t next = links[way].next;
+    links[prev].next = next;
+    if (list->next == way) {
+        list->next = prev;
+    } else {
+        links[next].prev = prev;
+    }
+
+    links[way].next = head;
+    links[head].prev = (uint16_t) way;
+    list->prev = (uint16_t) way;
+}
+
+static inline uint64_t policy_lru_victim(void* state, uint64_t set, uint64_t ways)
+{
+    const lru_link_t* list = (const lru_link_t*) state + set * (ways + 1);
+    return list->next;
+}
+
+const policy_t* policy_get(enum REPLACEMENT_POLICY policy);
+int policy_from_name(const char* name, enum REPLACEMENT_POLICY* policy);
+const char* policy_name(enum REPLACEMENT_POLICY policy);
+
+#endif
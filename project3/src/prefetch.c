@@ -0,0 +1,342 @@
+#include <string.h>
+#include <strings.h>
+#include "prefetch.h"
+
+#define TRUE 1
+#define FALSE 0
+
+// Multiplicative hashing constant for the direct-mapped side tables
+#define HASH_MULT 0x9e3779b97f4a7c15ULL
+// Prefetches remembered until they arrive, for late prefetch detection
+#define INFLIGHT_BITS 8
+// Blocks remembered after a prefetch evicted them, for pollution
+#define EVICTED_BITS 10
+
+// Stride: entries of the region table and the region size
+#define STRIDE_ENTRIES 64
+#define STRIDE_REGION_BITS 12
+// Stride: matching strides seen before prefetching starts
+#define STRIDE_THRESHOLD 1
+#define STRIDE_MAX_CONFIDENCE 3
+
+// Stream: streams tracked at once, and how far ahead of a stream's last
+// block a miss may land and still advance it
+#define STREAM_ENTRIES 16
+#define STREAM_WINDOW 4
+
+static uint64_t hash(uint64_t key, uint64_t bits)
+{
+    return (key * HASH_MULT) >> (64 - bits);
+}
+
+/*
+ * Next-line: on a miss, or the first hit to a prefetched block (tagged
+ * prefetching), fetch the next degree blocks.
+ */
+
+typedef struct nextline_state {
+    uint64_t B;
+    uint64_t degree;
+} nextline_state_t;
+
+static void nextline_init(void* state, uint64_t B, uint64_t degree)
+{
+    nextline_state_t* nl = state;
+    nl->B = B;
+    nl->degree = degree;
+}
+
+static size_t nextline_train(void* state, uint64_t address, uint8_t outcome, uint64_t* prefetches)
+{
+    const nextline_state_t* nl = state;
+    if (outcome == TRUE) return 0;
+
+    uint64_t block = address >> nl->B;
+    for (uint64_t k = 0; k < nl->degree; k++) {
+        prefetches[k] = (block + k + 1) << nl->B;
+    }
+    return nl->degree;
+}
+
+/*
+ * Stride: a direct-mapped table of memory regions, each remembering the
+ * last address and stride seen in it. Once the same stride repeats,
+ * fetch degree strides ahead.
+ */
+
+typedef struct stride_entry {
+    uint64_t region;        // Region number + 1, or 0 if unused
+    uint64_t last;
+    int64_t stride;
+    uint64_t confidence;
+} stride_entry_t;
+
+typedef struct stride_state {
+    uint64_t degree;
+    stride_entry_t entries[STRIDE_ENTRIES];
+} stride_state_t;
+
+static void stride_init(void* state, uint64_t B, uint64_t degree)
+{
+    (void) B;
+    ((stride_state_t*) state)->degree = degree;
+}
+
+static size_t stride_train(void* state, uint64_t address, uint8_t outcome, uint64_t* prefetches)
+{
+    (void) outcome;
+    stride_state_t* st = state;
+    uint64_t region = address >> STRIDE_REGION_BITS;
+    stride_entry_t* entry = &st->entries[region % STRIDE_ENTRIES];
+
+    if (entry->region != region + 1) {
+        entry->region = region + 1;
+        entry->last = address;
+        entry->stride = 0;
+        entry->confidence = 0;
+        return 0;
+    }
+
+    int64_t delta = (int64_t) (address - entry->last);
+    if (delta == 0) return 0;
+    if (delta == entry->stride) {
+        if (entry->confidence < STRIDE_MAX_CONFIDENCE) entry->confidence++;
+    } else {
+        entry->stride = delta;
+        entry->confidence = 0;
+    }
+    entry->last = address;
+    if (entry->confidence < STRIDE_THRESHOLD) return 0;
+
+    for (uint64_t k = 0; k < st->degree; k++) {
+        prefetches[k] = address + (uint64_t) entry->stride * (k + 1);
+    }
+    return st->degree;
+}
+
+/*
+ * Stream: a handful of stream trackers in the spirit of stream buffers,
+ * except that the prefetched blocks go into the cache. Misses next to a
+ * tracker's last block set its direction; further misses (or first hits
+ * to prefetched blocks) within STREAM_WINDOW blocks ahead advance it and
+ * fetch degree blocks beyond. Untracked misses replace the least
+ * recently advanced tracker.
+ */
+
+typedef struct stream_entry {
+    uint64_t last;          // Last block of the stream
+    int64_t direction;      // +1, -1, or 0 while training
+    uint64_t stamp;         // Time of the last update, for replacement
+    uint8_t valid;
+} stream_entry_t;
+
+typedef struct stream_state {
+    uint64_t B;
+    uint64_t degree;
+    uint64_t now;
+    stream_entry_t entries[STREAM_ENTRIES];
+} stream_state_t;
+
+static void stream_init(void* state, uint64_t B, uint64_t degree)
+{
+    stream_state_t* st = state;
+    st->B = B;
+    st->degree = degree;
+}
+
+static size_t stream_train(void* state, uint64_t address, uint8_t outcome, uint64_t* prefetches)
+{
+    stream_state_t* st = state;
+    if (outcome == TRUE) return 0;
+
+    uint64_t block = address >> st->B;
+    st->now++;
+
+    stream_entry_t* match = NULL;
+    stream_entry_t* oldest = &st->entries[0];
+    for (unsigned i = 0; i < STREAM_ENTRIES && !match; i++) {
+        stream_entry_t* entry = &st->entries[i];
+        if (!entry->valid) {
+            oldest = entry;
+            continue;
+        }
+        if (oldest->valid && entry->stamp < oldest->stamp) oldest = entry;
+
+        int64_t distance = (int64_t) (block - entry->last);
+        if (entry->direction == 0 && (distance == 1 || distance == -1)) {
+            entry->direction = distance;
+            match = entry;
+        } else if (entry->direction != 0 && distance * entry->direction > 0
+                   && distance * entry->direction <= STREAM_WINDOW) {
+            match = entry;
+        }
+    }
+
+    if (!match) {
+        oldest->valid = TRUE;
+        oldest->last = block;
+        oldest->direction = 0;
+        oldest->stamp = st->now;
+        return 0;
+    }
+
+    match->last = block;
+    match->stamp = st->now;
+    for (uint64_t k = 0; k < st->degree; k++) {
+        prefetches[k] = (block + (uint64_t) (match->direction * (int64_t) (k + 1))) << st->B;
+    }
+    return st->degree;
+}
+
+static const prefetcher_t prefetchers[] = {
+    { "NEXTLINE", sizeof(nextline_state_t), nextline_init, nextline_train },
+    { "STRIDE", sizeof(stride_state_t), stride_init, stride_train },
+    { "STREAM", sizeof(stream_state_t), stream_init, stream_train },
+};
+
+#define NUM_PREFETCHERS (sizeof(prefetchers) / sizeof(prefetchers[0]))
+
+/**
+ * Looks up a prefetcher by its name, ignoring case
+ *
+ * @return The prefetcher, or NULL if there is none with that name
+ */
+const prefetcher_t* prefetcher_from_name(const char* name)
+{
+    for (unsigned i = 0; i < NUM_PREFETCHERS; i++) {
+        if (strcasecmp(name, prefetchers[i].name) == 0) return &prefetchers[i];
+    }
+    return NULL;
+}
+
+/*
+ * A cache driven by demand accesses and a prefetcher. Prefetches count
+ * as arriving latency demand accesses after they are issued.
+ */
+
+typedef struct inflight {
+    uint64_t block;         // Block number + 1, or 0 if unused
+    uint64_t arrival;
+} inflight_t;
+
+struct prefetch_sim {
+    cache_t* cache;
+    const prefetcher_t* prefetcher;
+    void* state;
+    uint64_t B;
+    uint64_t degree;
+    uint64_t latency;
+    uint64_t now;           // Demand accesses so far
+
+    inflight_t inflight[1 << INFLIGHT_BITS];
+    uint64_t evicted[1 << EVICTED_BITS];    // Block number + 1, or 0
+};
+
+/**
+ * Creates a cache with a prefetcher attached
+ *
+ * @param degree Blocks fetched per prefetcher trigger, 1 to
+ *        PREFETCH_MAX_DEGREE
+ * @param latency Demand accesses between issuing a prefetch and its
+ *        block arriving
+ * @return The simulation, or NULL if the configuration is invalid or
+ *         memory could not be allocated
+ */
+prefetch_sim_t* prefetch_sim_create(uint64_t C, uint64_t B, uint64_t S,
+                                    enum REPLACEMENT_POLICY policy,
+                                    const prefetcher_t* prefetcher,
+                                    uint64_t degree, uint64_t latency)
+{
+    if (degree == 0 || degree > PREFETCH_MAX_DEGREE) return NULL;
+
+    prefetch_sim_t* sim = calloc(1, sizeof(prefetch_sim_t));
+    if (!sim) return NULL;
+    sim->cache = cache_create(C, B, S, policy);
+    sim->state = calloc(1, prefetcher->state_size);
+    if (!sim->cache || !sim->state) {
+        prefetch_sim_destroy(sim);
+        return NULL;
+    }
+
+    sim->prefetcher = prefetcher;
+    sim->B = B;
+    sim->degree = degree;
+    sim->latency = latency;
+    prefetcher->init(sim->state, B, degree);
+    return sim;
+}
+
+/**
+ * Simulates one demand access and the prefetches it triggers
+ *
+ * @param stats The demand access statistics; prefetch fills add to the
+ *        write backs but not to the accesses
+ * @param pstats The prefetch statistics
+ * @return TRUE if the demand access hit, FALSE if not
+ */
+uint8_t prefetch_sim_access(prefetch_sim_t* sim, char rw, uint64_t address,
+                            cache_stats_t* stats, prefetch_stats_t* pstats)
+{
+    uint64_t block = address >> sim->B;
+    cache_victim_t victim;
+    uint8_t outcome = cache_access_victim_h(sim->cache, rw, address, stats, &victim);
+    sim->now++;
+
+    if (outcome == CACHE_PREFETCH_HIT) {
+        const inflight_t* flight = &sim->inflight[hash(block, INFLIGHT_BITS)];
+        if (flight->block == block + 1 && flight->arrival > sim->now) {
+            pstats->late++;
+        } else {
+            pstats->useful++;
+        }
+    } else if (!outcome) {
+        uint64_t* evicted = &sim->evicted[hash(block, EVICTED_BITS)];
+        if (*evicted == block + 1) {
+            pstats->polluting++;
+            *evicted = 0;
+        }
+        pstats->unused += victim.valid && victim.prefetched;
+    }
+
+    uint64_t prefetches[PREFETCH_MAX_DEGREE];
+    size_t n = sim->prefetcher->train(sim->state, address, outcome, prefetches);
+    for (size_t i = 0; i < n; i++) {
+        if (cache_prefetch_h(sim->cache, prefetches[i], &victim)) continue;
+
+        uint64_t prefetched = prefetches[i] >> sim->B;
+        inflight_t* flight = &sim->inflight[hash(prefetched, INFLIGHT_BITS)];
+        flight->block = prefetched + 1;
+        flight->arrival = sim->now + sim->latency;
+        pstats->issued++;
+
+        if (victim.valid) {
+            uint64_t victim_block = victim.address >> sim->B;
+            sim->evicted[hash(victim_block, EVICTED_BITS)] = victim_block + 1;
+            stats->write_backs += victim.dirty;
+            pstats->unused += victim.prefetched;
+        }
+    }
+    return outcome != FALSE;
+}
+
+/**
+ * Frees a prefetching simulation and its cache
+ */
+void prefetch_sim_destroy(prefetch_sim_t* sim)
+{
+    if (!sim) return;
+    cache_destroy(sim->cache);
+    free(sim->state);
+    free(sim);
+}
+
+/**
+ * The AAT seen by demand accesses with the prefetcher, charging late
+ * prefetches the full memory access time like misses
+ */
+double prefetch_effective_aat(const cache_stats_t* stats, const prefetch_stats_t* pstats)
+{
+    if (stats->accesses == 0) return 0.0;
+    double stalls = (double) (stats->misses + pstats->late) / (double) stats->accesses;
+    return (double) stats->cache_access_time + stalls * (double) stats->memory_access_time;
+}
@@ -0,0 +1,54 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include "cachesim.h"
+
+// Largest number of prefetches a prefetcher may issue per access
+#define PREFETCH_MAX_DEGREE 16
+
+/**
+ * A hardware prefetcher model. It watches the demand accesses and their
+ * outcome and names blocks to prefetch; prefetch_sim_t brings those into
+ * the cache. State is a fixed size block laid out however the
+ * prefetcher likes.
+ */
+typedef struct prefetcher {
+    const char* name;
+    size_t state_size;
+
+    // Sets up zeroed state for blocks of 2^B bytes
+    void (*init)(void* state, uint64_t B, uint64_t degree);
+    // Observes a demand access, whose outcome is a cache_access_h return
+    // value, and writes up to degree addresses to prefetch
+    size_t (*train)(void* state, uint64_t address, uint8_t outcome, uint64_t* prefetches);
+} prefetcher_t;
+
+/**
+ * What became of the prefetches. A useful prefetch was hit by a demand
+ * access after it arrived and a late one before it arrived; a polluting
+ * prefetch evicted a block that a later demand access missed on; an
+ * unused prefetch was evicted before any demand access touched it.
+ */
+typedef struct prefetch_stats {
+    uint64_t issued;
+    uint64_t useful;
+    uint64_t late;
+    uint64_t polluting;
+    uint64_t unused;
+} prefetch_stats_t;
+
+typedef struct prefetch_sim prefetch_sim_t;
+
+const prefetcher_t* prefetcher_from_name(const char* name);
+
+prefetch_sim_t* prefetch_sim_create(uint64_t C, uint64_t B, uint64_t S,
+                                    enum REPLACEMENT_POLICY policy,
+                                    const prefetcher_t* prefetcher,
+                                    uint64_t degree, uint64_t latency);
+uint8_t prefetch_sim_access(prefetch_sim_t* sim, char rw, uint64_t address,
+                            cache_stats_t* stats, prefetch_stats_t* pstats);
+void prefetch_sim_destroy(prefetch_sim_t* sim);
+
+double prefetch_effective_aat(const cache_stats_t* stats, const prefetch_stats_t* pstats);
+
+#endif
@@ -0,0 +1,124 @@
+#include "reader.h"
+
+#define TRUE 1
+#define FALSE 0
+
+/**
+ * Decodes the next batch of accesses from the trace
+ */
+static void fill_batch(trace_t* trace, access_batch_t* batch)
+{
+    size_t n = 0;
+    while (n < READER_BATCH && trace_next(trace, &batch->rw[n], &batch->addresses[n])) {
+        n++;
+    }
+    batch->n = n;
+}
+
+/**
+ * Producer thread: fills the ring until the trace ends or the consumer
+ * stops
+ */
+static void* reader_producer(void* arg)
+{
+    reader_t* reader = arg;
+
+    for (;;) {
+        pthread_mutex_lock(&reader->lock);
+        while (reader->filled - reader->consumed == READER_RING && !reader->stop) {
+            pthread_cond_wait(&reader->more_consumed, &reader->lock);
+        }
+        size_t slot = reader->filled % READER_RING;
+        uint8_t stop = reader->stop;
+        pthread_mutex_unlock(&reader->lock);
+        if (stop) break;
+
+        // The slot is outside [consumed, filled), so the consumer is not using it
+        access_batch_t* batch = &reader->ring[slot];
+        fill_batch(reader->trace, batch);
+
+        pthread_mutex_lock(&reader->lock);
+        reader->filled++;
+        reader->done = batch->n < READER_BATCH;
+        pthread_cond_signal(&reader->more_filled);
+        pthread_mutex_unlock(&reader->lock);
+        if (batch->n < READER_BATCH) break;
+    }
+    return NULL;
+}
+
+/**
+ * Starts reading a trace ahead of the simulator. The trace must stay
+ * open, and must not be read from elsewhere, until reader_stop.
+ *
+ * @param reader The reader to initialize
+ * @param trace The trace to read
+ * @return 0 on success, -1 on failure
+ */
+int reader_start(reader_t* reader, trace_t* trace)
+{
+    memset(reader, 0, sizeof(reader_t));
+    reader->trace = trace;
+    reader->ring = malloc(READER_RING * sizeof(access_batch_t));
+    if (!reader->ring) return -1;
+
+    pthread_mutex_init(&reader->lock, NULL);
+    pthread_cond_init(&reader->more_filled, NULL);
+    pthread_cond_init(&reader->more_consumed, NULL);
+    reader->threaded = pthread_create(&reader->producer, NULL, reader_producer, reader) == 0;
+    return 0;
+}
+
+/**
+ * Hands the next batch of accesses to the simulator, giving back the
+ * batch returned by the previous call
+ *
+ * @return The next non-empty batch, valid until the next call, or NULL
+ *         at the end of the trace
+ */
+const access_batch_t* reader_next(reader_t* reader)
+{
+    if (!reader->threaded) {
+        if (reader->done) return NULL;
+        fill_batch(reader->trace, &reader->ring[0]);
+        reader->done = reader->ring[0].n < READER_BATCH;
+        return reader->ring[0].n ? &reader->ring[0] : NULL;
+    }
+
+    pthread_mutex_lock(&reader->lock);
+    if (reader->holding) {
+        reader->consumed++;
+        reader->holding = FALSE;
+        pthread_cond_signal(&reader->more_consumed);
+    }
+    while (reader->consumed == reader->filled && !reader->done) {
+        pthread_cond_wait(&reader->more_filled, &reader->lock);
+    }
+    const access_batch_t* batch = NULL;
+    if (reader->consumed < reader->filled) {
+        batch = &reader->ring[reader->consumed % READER_RING];
+        if (batch->n == 0) batch = NULL;
+        reader->holding = batch != NULL;
+    }
+    pthread_mutex_unlock(&reader->lock);
+    return batch;
+}
+
+/**
+ * Stops the producer thread and frees the ring. The trace is left open.
+ */
+void reader_stop(reader_t* reader)
+{
+    if (reader->threaded) {
+        pthread_mutex_lock(&reader->lock);
+        reader->stop = TRUE;
+        pthread_cond_signal(&reader->more_consumed);
+        pthread_mutex_unlock(&reader->lock);
+        pthread_join(reader->producer, NULL);
+    }
+    pthread_cond_destroy(&reader->more_consumed);
+    pthread_cond_destroy(&reader->more_filled);
+    pthread_mutex_destroy(&reader->lock);
+    free(reader->ring);
+    memset(reader, 0, sizeof(reader_t));
+}
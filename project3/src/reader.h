@@ -0,0 +1,52 @@
+#ifndef READER_H
+#define READER_H
+
+#include <pthread.h>
+#include "trace.h"
+
+// Accesses per batch handed from the reader thread to the simulator
+#define READER_BATCH 4096
+// Batches in flight between the two threads
+#define READER_RING 8
+
+/**
+ * A batch of decoded accesses. A batch shorter than READER_BATCH is the
+ * last one of the trace.
+ */
+typedef struct access_batch {
+    size_t n;
+    char rw[READER_BATCH];
+    uint64_t addresses[READER_BATCH];
+} access_batch_t;
+
+/*
+ * Reads a trace ahead of the simulator on a producer thread. The
+ * producer decodes (and, with a compressed trace, inflates) the trace
+ * into a ring of batches while the consumer simulates the batches
+ * already filled, so I/O, decompression, parsing and simulation
+ * overlap. If no thread can be started the batches are filled on
+ * demand instead.
+ */
+typedef struct reader {
+    trace_t* trace;
+    access_batch_t* ring;   // READER_RING batches
+
+    // Batches filled and consumed so far; ring[i % READER_RING] is batch i
+    size_t filled;
+    size_t consumed;
+    uint8_t holding;        // The consumer is using ring[consumed % READER_RING]
+    uint8_t done;           // The producer has filled the last batch
+    uint8_t stop;           // The consumer is going away
+
+    uint8_t threaded;
+    pthread_t producer;
+    pthread_mutex_t lock;
+    pthread_cond_t more_filled;
+    pthread_cond_t more_consumed;
+} reader_t;
+
+int reader_start(reader_t* reader, trace_t* trace);
+const access_batch_t* reader_next(reader_t* reader);
+void reader_stop(reader_t* reader);
+
+#endif
@@ -0,0 +1,174 @@
+#include <math.h>
+#include <string.h>
+#include "sample.h"
+
+// Accesses filtered and simulated per cache_access_batch_h call
+#define SAMPLE_BATCH 1024
+// Odd, so multiplying by it permutes the set indices
+#define SAMPLE_HASH 0x9e3779b97f4a7c15ULL
+// Normal quantile for a two-sided 95% confidence interval
+#define SAMPLE_Z 1.96
+
+struct sampler {
+    cache_t* cache;
+    uint64_t index_shift;
+    uint64_t index_mask;
+    uint64_t num_sets;
+    uint64_t keep;              // Sets whose hashed index is below this are simulated
+
+    uint64_t accesses;          // Every access, sampled or not
+    uint64_t writes;
+    cache_stats_t sampled;      // Counters of the sampled sets only
+
+    // Per set, only meaningful for the sampled sets
+    uint64_t* set_accesses;
+    uint64_t* set_misses;
+};
+
+static int is_sampled(const sampler_t* sampler, uint64_t index)
+{
+    return ((index * SAMPLE_HASH) & sampler->index_mask) < sampler->keep;
+}
+
+/**
+ * Creates a sampled simulation of a cache
+ *
+ * @param C, B, S, policy The configuration of the cache
+ * @param ratio Simulate 1 in this many sets; a power of two, at most the
+ *        number of sets
+ * @return The sampler, or NULL if the configuration is invalid or memory
+ *         could not be allocated
+ */
+sampler_t* sampler_create(uint64_t C, uint64_t B, uint64_t S,
+                          enum REPLACEMENT_POLICY policy, uint64_t ratio)
+{
+    if (C >= 64 || C < B + S) return NULL;
+    uint64_t num_sets = (uint64_t) 1 << (C - B - S);
+    if (ratio == 0 || (ratio & (ratio - 1)) || ratio > num_sets) return NULL;
+
+    sampler_t* sampler = calloc(1, sizeof(sampler_t));
+    if (!sampler) return NULL;
+    sampler->cache = cache_create(C, B, S, policy);
+    sampler->set_accesses = calloc(num_sets, sizeof(uint64_t));
+    sampler->set_misses = calloc(num_sets, sizeof(uint64_t));
+    if (!sampler->cache || !sampler->set_accesses || !sampler->set_misses) {
+        sampler_destroy(sampler);
+        return NULL;
+    }
+
+    sampler->index_shift = B;
+    sampler->index_mask = num_sets - 1;
+    sampler->num_sets = num_sets;
+    sampler->keep = num_sets / ratio;
+    return sampler;
+}
+
+/**
+ * Simulates a batch of accesses, dropping those outside the sampled sets
+ */
+void sampler_access_batch(sampler_t* sampler, const char* rw, const uint64_t* addresses, size_t n)
+{
+    char kept_rw[SAMPLE_BATCH];
+    uint64_t kept[SAMPLE_BATCH];
+    uint8_t hits[SAMPLE_BATCH];
+    uint64_t shift = sampler->index_shift;
+    uint64_t mask = sampler->index_mask;
+
+    for (size_t start = 0; start < n; start += SAMPLE_BATCH) {
+        size_t chunk = n - start < SAMPLE_BATCH ? n - start : SAMPLE_BATCH;
+
+        // Branch-free filter: always copy, only advance past sampled accesses
+        size_t m = 0;
+        uint64_t writes = 0;
+        for (size_t i = 0; i < chunk; i++) {
+            char c = rw[start + i];
+            uint64_t address = addresses[start + i];
+            writes += c == WRITE;
+            kept_rw[m] = c;
+            kept[m] = address;
+            m += (size_t) is_sampled(sampler, (address >> shift) & mask);
+        }
+        sampler->accesses += chunk;
+        sampler->writes += writes;
+
+        cache_access_batch_h(sampler->cache, kept_rw, kept, m, hits, &sampler->sampled);
+        for (size_t i = 0; i < m; i++) {
+            uint64_t index = (kept[i] >> shift) & mask;
+            sampler->set_accesses[index]++;
+            sampler->set_misses[index] += !hits[i];
+        }
+    }
+}
+
+static uint64_t scale(uint64_t sampled_count, uint64_t total, uint64_t sampled_total)
+{
+    if (sampled_total == 0) return 0;
+    return (uint64_t) llround((double) sampled_count * (double) total / (double) sampled_total);
+}
+
+/**
+ * Extrapolates the statistics of the whole cache from the sampled sets.
+ * The access times in stats must already be set. Accesses, reads and
+ * writes are exact; misses and writebacks are ratio estimates.
+ *
+ * @param sampler The sampler
+ * @param stats Filled with the estimated statistics
+ * @param bounds Filled with 95% confidence intervals for the miss rate
+ *        and AAT
+ */
+void sampler_stats(const sampler_t* sampler, cache_stats_t* stats, sample_bounds_t* bounds)
+{
+    const cache_stats_t* sampled = &sampler->sampled;
+
+    stats->accesses = sampler->accesses;
+    stats->writes = sampler->writes;
+    stats->reads = sampler->accesses - sampler->writes;
+    stats->read_misses = scale(sampled->read_misses, stats->reads, sampled->reads);
+    stats->write_misses = scale(sampled->write_misses, stats->writes, sampled->writes);
+    stats->misses = stats->read_misses + stats->write_misses;
+    stats->write_backs = scale(sampled->write_backs, stats->accesses, sampled->accesses);
+    cache_compute_stats(stats);
+
+    // The miss rate is a ratio estimate over the sampled sets (clusters
+    // of accesses); its variance follows from the per-set residuals
+    uint64_t n = sampler->keep;
+    double half_width = 1.0;
+    if (n == sampler->num_sets) {
+        half_width = 0.0;
+    } else if (n > 1 && sampled->accesses > 0) {
+        double r = (double) sampled->misses / (double) sampled->accesses;
+        double mean_accesses = (double) sampled->accesses / (double) n;
+        double sum_sq = 0.0;
+        for (uint64_t index = 0; index < sampler->num_sets; index++) {
+            if (!is_sampled(sampler, index)) continue;
+            double residual = (double) sampler->set_misses[index]
+                - r * (double) sampler->set_accesses[index];
+            sum_sq += residual * residual;
+        }
+        double fpc = 1.0 - (double) n / (double) sampler->num_sets;
+        double variance = fpc * sum_sq / (double) (n - 1) / ((double) n * mean_accesses * mean_accesses);
+        half_width = SAMPLE_Z * sqrt(variance);
+    }
+
+    bounds->sampled_sets = n;
+    bounds->num_sets = sampler->num_sets;
+    bounds->sampled_accesses = sampled->accesses;
+    bounds->miss_rate_low = fmax(stats->miss_rate - half_width, 0.0);
+    bounds->miss_rate_high = fmin(stats->miss_rate + half_width, 1.0);
+    bounds->aat_low = (double) stats->cache_access_time
+        + bounds->miss_rate_low * (double) stats->memory_access_time;
+    bounds->aat_high = (double) stats->cache_access_time
+        + bounds->miss_rate_high * (double) stats->memory_access_time;
+}
+
+/**
+ * Frees a sampler and its cache
+ */
+void sampler_destroy(sampler_t* sampler)
+{
+    if (!sampler) return;
+    cache_destroy(sampler->cache);
+    free(sampler->set_accesses);
+    free(sampler->set_misses);
+    free(sampler);
+}
@@ -0,0 +1,36 @@
+#ifndef SAMPLE_H
+#define SAMPLE_H
+
+#include "cachesim.h"
+
+/*
+ * Set sampling: only 1 in `ratio` sets of the cache is simulated. Sets
+ * never interact, so the sampled sets behave exactly as they would in a
+ * full simulation; the other sets' accesses are dropped by a cheap
+ * index filter before they reach the cache. Counters are extrapolated
+ * from the sampled sets and the miss rate gets a confidence interval
+ * from the spread between sets.
+ */
+
+typedef struct sampler sampler_t;
+
+/**
+ * Estimates and 95% confidence intervals from a sampled simulation
+ */
+typedef struct sample_bounds {
+    uint64_t sampled_sets;
+    uint64_t num_sets;
+    uint64_t sampled_accesses;
+    double miss_rate_low;
+    double miss_rate_high;
+    double aat_low;
+    double aat_high;
+} sample_bounds_t;
+
+sampler_t* sampler_create(uint64_t C, uint64_t B, uint64_t S,
+                          enum REPLACEMENT_POLICY policy, uint64_t ratio);
+void sampler_access_batch(sampler_t* sampler, const char* rw, const uint64_t* addresses, size_t n);
+void sampler_stats(const sampler_t* sampler, cache_stats_t* stats, sample_bounds_t* bounds);
+void sampler_destroy(sampler_t* sampler);
+
+#endif
@@ -0,0 +1,226 @@
+#include <string.h>
+#include "stackdist.h"
+
+#define TRUE 1
+#define FALSE 0
+
+// Dirty bits are kept in a uint16_t per stack entry, one per associativity
+#define STACKDIST_MAX_S 15
+
+/**
+ * The recency stacks for one index width. Every set keeps its blocks
+ * ordered from most to least recently used, truncated at the largest
+ * associativity simulated for this width; anything deeper is a miss in
+ * every configuration.
+ */
+typedef struct level {
+    uint64_t max_s;         // Associativities 2^0 .. 2^max_s are simulated
+    uint64_t depth;         // 2^max_s entries per set
+    uint64_t num_sets;
+
+    uint64_t* blocks;       // Block numbers, num_sets * depth
+    uint16_t* dirty;        // Bit j set: block is dirty in the 2^j way cache
+    uint64_t* count;        // Live entries per set
+
+    // Accesses bucketed by stack depth d: bucket 0 is d == 0, bucket
+    // b is 2^(b-1) <= d < 2^b, and bucket max_s + 1 is "not in stack".
+    // An access misses in the 2^j way cache exactly when its bucket is
+    // greater than j.
+    uint64_t read_hist[STACKDIST_MAX_S + 2];
+    uint64_t write_hist[STACKDIST_MAX_S + 2];
+    uint64_t write_backs[STACKDIST_MAX_S + 1];
+} level_t;
+
+struct stackdist {
+    uint64_t C_max;
+    uint64_t B;
+    uint64_t num_levels;    // Index widths 0 .. C_max - B
+    level_t* levels;
+
+    uint64_t reads;
+    uint64_t writes;
+};
+
+/**
+ * Creates the stacks needed to simulate every LRU cache with block size
+ * 2^B, size up to 2^C_max and associativity up to 2^S_max
+ *
+ * @return The new simulator, or NULL if the parameters are out of range
+ *         or memory runs out
+ */
+stackdist_t* stackdist_create(uint64_t C_max, uint64_t B, uint64_t S_max)
+{
+    if (C_max < B || S_max > STACKDIST_MAX_S) {
+        return NULL;
+    }
+
+    stackdist_t* sd = calloc(1, sizeof(stackdist_t));
+    if (!sd) return NULL;
+    sd->C_max = C_max;
+    sd->B = B;
+    sd->num_levels = C_max - B + 1;
+    sd->levels = calloc(sd->num_levels, sizeof(level_t));
+    if (!sd->levels) {
+        free(sd);
+        return NULL;
+    }
+
+    for (uint64_t k = 0; k < sd->num_levels; k++) {
+        level_t* level = &sd->levels[k];
+        uint64_t room = C_max - B - k;
+
+        level->max_s = room < S_max ? room : S_max;
+        level->depth = (uint64_t) 1 << level->max_s;
+        level->num_sets = (uint64_t) 1 << k;
+        level->blocks = malloc(level->num_sets * level->depth * sizeof(uint64_t));
+        level->dirty = malloc(level->num_sets * level->depth * sizeof(uint16_t));
+        level->count = calloc(level->num_sets, sizeof(uint64_t));
+        if (!level->blocks || !level->dirty || !level->count) {
+            stackdist_destroy(sd);
+            return NULL;
+        }
+    }
+    return sd;
+}
+
+/**
+ * Moves a block to the top of its set's stack in one level and records
+ * the depth it was found at
+ */
+static void level_access(level_t* level, uint64_t block, uint8_t is_write)
+{
+    uint64_t set = block & (level->num_sets - 1);
+    uint64_t* stack = &level->blocks[set * level->depth];
+    uint16_t* dirty = &level->dirty[set * level->depth];
+    uint64_t n = level->count[set];
+    uint16_t all = (uint16_t) ((1u << (level->max_s + 1)) - 1);
+
+    uint64_t d = 0;
+    while (d < n && stack[d] != block) d++;
+
+    uint64_t bucket;
+    uint16_t mask;
+    if (d < n) {
+        bucket = d ? (uint64_t) (64 - __builtin_clzll(d)) : 0;
+
+        // Caches with 2^j <= d ways evicted this block since its last
+        // use, writing it back if it was dirty there
+        uint16_t evicted = (uint16_t) ((1u << bucket) - 1);
+        uint16_t written = dirty[d] & evicted;
+        while (written) {
+            level->write_backs[__builtin_ctz(written)]++;
+            written &= (uint16_t) (written - 1);
+        }
+        mask = is_write ? all : (uint16_t) (dirty[d] & ~evicted);
+    } else {
+        bucket = level->max_s + 1;
+        if (n == level->depth) {
+            // The bottom entry falls out of every simulated cache
+            uint16_t written = dirty[--d];
+            while (written) {
+                level->write_backs[__builtin_ctz(written)]++;
+                written &= (uint16_t) (written - 1);
+            }
+        } else {
+            level->count[set] = ++n;
+        }
+        mask = is_write ? all : 0;
+    }
+
+    memmove(&stack[1], &stack[0], d * sizeof(uint64_t));
+    memmove(&dirty[1], &dirty[0], d * sizeof(uint16_t));
+    stack[0] = block;
+    dirty[0] = mask;
+
+    if (is_write) {
+        level->write_hist[bucket]++;
+    } else {
+        level->read_hist[bucket]++;
+    }
+}
+
+/**
+ * Simulates one access in every configuration at once
+ *
+ * @param sd The simulator
+ * @param rw The type of access, READ or WRITE
+ * @param address The address that is being accessed
+ */
+void stackdist_access(stackdist_t* sd, char rw, uint64_t address)
+{
+    uint8_t is_write = rw == WRITE;
+    uint64_t block = address >> sd->B;
+
+    if (is_write) {
+        sd->writes++;
+    } else {
+        sd->reads++;
+    }
+    for (uint64_t k = 0; k < sd->num_levels; k++) {
+        level_access(&sd->levels[k], block, is_write);
+    }
+}
+
+/**
+ * Fills in the statistics that a single LRU cache with the given
+ * parameters would have reported for the accesses so far. The access
+ * times must already be set in stats; the counters, miss rate and AAT
+ * are overwritten.
+ *
+ * @param sd The simulator
+ * @param C The total size of the cache is 2^C bytes
+ * @param S The set associativity of the cache is 2^S
+ * @param stats The struct to store the stats in
+ * @return 0 on success, -1 if the configuration was not simulated
+ */
+int stackdist_stats(const stackdist_t* sd, uint64_t C, uint64_t S, cache_stats_t* stats)
+{
+    if (C > sd->C_max || C < sd->B + S) {
+        return -1;
+    }
+    const level_t* level = &sd->levels[C - sd->B - S];
+    if (S > level->max_s) {
+        return -1;
+    }
+
+    stats->reads = sd->reads;
+    stats->writes = sd->writes;
+    stats->accesses = sd->reads + sd->writes;
+    stats->read_misses = 0;
+    stats->write_misses = 0;
+    for (uint64_t b = S + 1; b <= level->max_s + 1; b++) {
+        stats->read_misses += level->read_hist[b];
+        stats->write_misses += level->write_hist[b];
+    }
+    stats->misses = stats->read_misses + stats->write_misses;
+
+    // Blocks that sank below the cache's ways since their last use were
+    // evicted, but their write backs have not been counted yet
+    uint64_t ways = (uint64_t) 1 << S;
+    uint64_t write_backs = level->write_backs[S];
+    for (uint64_t set = 0; set < level->num_sets; set++) {
+        const uint16_t* dirty = &level->dirty[set * level->depth];
+        for (uint64_t d = ways; d < level->count[set]; d++) {
+            write_backs += (dirty[d] >> S) & 1;
+        }
+    }
+    stats->write_backs = write_backs;
+
+    cache_compute_stats(stats);
+    return 0;
+}
+
+/**
+ * Frees a simulator created by stackdist_create
+ */
+void stackdist_destroy(stackdist_t* sd)
+{
+    if (!sd) return;
+    for (uint64_t k = 0; k < sd->num_levels; k++) {
+        free(sd->levels[k].blocks);
+        free(sd->levels[k].dirty);
+        free(sd->levels[k].count);
+    }
+    free(sd->levels);
+    free(sd);
+}
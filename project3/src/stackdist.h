@@ -0,0 +1,23 @@
+#ifndef STACKDIST_H
+#define STACKDIST_H
+
+#include "cachesim.h"
+
+/*
+ * Single-pass LRU simulation of every cache size and associativity at
+ * a fixed block size, using per-set Mattson stacks.
+ *
+ * LRU is a stack algorithm: a block at depth d of its set's recency
+ * stack is resident in every cache of that set count with more than d
+ * ways. One stack per index width therefore answers hit or miss for all
+ * associativities at once.
+ */
+
+typedef struct stackdist stackdist_t;
+
+stackdist_t* stackdist_create(uint64_t C_max, uint64_t B, uint64_t S_max);
+void stackdist_access(stackdist_t* sd, char rw, uint64_t address);
+int stackdist_stats(const stackdist_t* sd, uint64_t C, uint64_t S, cache_stats_t* stats);
+void stackdist_destroy(stackdist_t* sd);
+
+#endif
@@ -0,0 +1,435 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include "missclass.h"
+#include "policy.h"
+#include "sweep.h"
+#include "trace.h"
+
+// Records unpacked and simulated per cache_access_batch_h call
+#define SWEEP_BATCH 1024
+// Largest associativity cache_create accepts
+#define SWEEP_MAX_S 16
+// Largest C - B cache_create accepts
+#define SWEEP_MAX_BLOCKS 40
+
+/**
+ * A trace decoded into packed binary records (see trace.h). Binary
+ * traces that could be mapped are used in place; anything else is
+ * decoded once into a heap array shared by every worker.
+ */
+typedef struct decoded_trace {
+    trace_t trace;
+    const uint64_t* records;
+    uint64_t* owned;        // Heap copy of the records, if one was needed
+    size_t count;
+} decoded_trace_t;
+
+/**
+ * State shared by the worker threads
+ */
+typedef struct sweep_state {
+    const sweep_config_t* configs;
+    decoded_trace_t* traces;
+    size_t num_traces;
+    size_t num_chunks;      // Pieces each trace is split into
+    uint64_t warmup;        // Accesses simulated before each chunk but not counted
+    size_t num_jobs;        // num_configs * num_traces * num_chunks
+    size_t next_job;        // Claimed with an atomic fetch-and-add
+    cache_stats_t* results;
+    miss_classes_t* classes;    // Per job 3C breakdown, or NULL to skip it
+    int failed;
+} sweep_state_t;
+
+/**
+ * Reads a list of configurations, one "C B S policy [name]" line each.
+ * The rest of the line after the policy is an optional title for the
+ * configuration. Blank lines and everything after a '#' are ignored.
+ *
+ * @param path The path of the configuration list
+ * @param configs Set to a malloc'd array of the configurations read
+ * @param num_configs Set to the number of configurations read
+ * @return 0 on success, -1 on failure
+ */
+int sweep_load_configs(const char* path, sweep_config_t** configs, size_t* num_configs)
+{
+    FILE* fin = fopen(path, "r");
+    if (!fin) {
+        perror("Unable to open configuration list");
+        return -1;
+    }
+
+    size_t n = 0, capacity = 16;
+    sweep_config_t* list = malloc(capacity * sizeof(sweep_config_t));
+    char line[256];
+    unsigned line_no = 0;
+    while (list && fgets(line, sizeof(line), fin)) {
+        line_no++;
+        char* comment = strchr(line, '#');
+        if (comment) *comment = '\0';
+
+        uint64_t c, b, s;
+        char policy[16];
+        int name_start = 0;
+        int ret = sscanf(line, "%" SCNu64 " %" SCNu64 " %" SCNu64 " %15s %n",
+                         &c, &b, &s, policy, &name_start);
+        if (ret <= 0) continue;
+        enum REPLACEMENT_POLICY r;
+        const char* problem = NULL;
+        if (ret != 4) {
+            problem = "expected \"C B S policy [name]\"";
+        } else if (c >= 64) {
+            problem = "C must be less than 64";
+        } else if (c < b + s) {
+            problem = "C must be at least B + S";
+        } else if (s > SWEEP_MAX_S) {
+            problem = "S must be at most 16";
+        } else if (c - b > SWEEP_MAX_BLOCKS) {
+            problem = "C - B must be at most 40";
+        } else if (policy_from_name(policy, &r)) {
+            problem = "unknown replacement policy";
+        }
+        if (problem) {
+            printf("Invalid configuration on line %u of %s: %s\n", line_no, path, problem);
+            free(list);
+            fclose(fin);
+            return -1;
+        }
+
+        if (n == capacity) {
+            capacity *= 2;
+            sweep_config_t* grown = realloc(list, capacity * sizeof(sweep_config_t));
+            if (!grown) {
+                free(list);
+                list = NULL;
+                break;
+            }
+            list = grown;
+        }
+        list[n].C = c;
+        list[n].B = b;
+        list[n].S = s;
+        list[n].policy = r;
+        snprintf(list[n].name, sizeof(list[n].name), "%s", line + name_start);
+        list[n].name[strcspn(list[n].name, "\r\n")] = '\0';
+        n++;
+    }
+    fclose(fin);
+
+    if (!list) {
+        printf("Out of memory reading %s\n", path);
+        return -1;
+    }
+    *configs = list;
+    *num_configs = n;
+    return 0;
+}
+
+/**
+ * Opens a trace and makes its records available as a packed array
+ */
+static int decode_trace(decoded_trace_t* decoded, const char* path)
+{
+    memset(decoded, 0, sizeof(decoded_trace_t));
+    if (trace_open(&decoded->trace, path)) {
+        return -1;
+    }
+
+    trace_t* trace = &decoded->trace;
+    if (trace->format == TRACE_BINARY && trace->mapped) {
+        decoded->records = (const uint64_t*) (const void*) trace->pos;
+        decoded->count = (size_t) (trace->end - trace->pos) / sizeof(uint64_t);
+        return 0;
+    }
+
+    size_t capacity = 1 << 16;
+    uint64_t* records = malloc(capacity * sizeof(uint64_t));
+    char rw;
+    uint64_t address;
+    while (records && trace_next(trace, &rw, &address)) {
+        if (decoded->count == capacity) {
+            capacity *= 2;
+            uint64_t* grown = realloc(records, capacity * sizeof(uint64_t));
+            if (!grown) {
+                free(records);
+                records = NULL;
+                break;
+            }
+            records = grown;
+        }
+        records[decoded->count++] = trace_pack(rw, address);
+    }
+    trace_close(trace);
+
+    if (!records) return -1;
+    decoded->records = decoded->owned = records;
+    return 0;
+}
+
+static void free_trace(decoded_trace_t* decoded)
+{
+    if (decoded->owned) {
+        free(decoded->owned);
+    } else {
+        trace_close(&decoded->trace);
+    }
+}
+
+/**
+ * Simulates records [start, end) of a trace, classifying the misses if
+ * mc is not NULL
+ */
+static void simulate_range(cache_t* cache, const uint64_t* records, size_t start, size_t end,
+                           cache_stats_t* stats, missclass_t* mc, miss_classes_t* classes)
+{
+    char rw[SWEEP_BATCH];
+    uint64_t addresses[SWEEP_BATCH];
+    uint8_t hits[SWEEP_BATCH];
+    for (; start < end; start += SWEEP_BATCH) {
+        size_t n = end - start < SWEEP_BATCH ? end - start : SWEEP_BATCH;
+        for (size_t i = 0; i < n; i++) {
+            uint64_t record = records[start + i];
+            rw[i] = (record & TRACE_WRITE_BIT) ? WRITE : READ;
+            addresses[i] = record & TRACE_ADDR_MASK;
+        }
+        cache_access_batch_h(cache, rw, addresses, n, mc ? hits : NULL, stats);
+        if (mc) {
+            missclass_batch(mc, addresses, hits, n, classes);
+        }
+    }
+}
+
+/**
+ * Worker thread: claims (configuration, trace, chunk) jobs until none
+ * are left
+ */
+static void* sweep_worker(void* arg)
+{
+    sweep_state_t* state = arg;
+
+    for (;;) {
+        size_t job = __atomic_fetch_add(&state->next_job, 1, __ATOMIC_RELAXED);
+        if (job >= state->num_jobs) break;
+
+        size_t chunk = job % state->num_chunks;
+        size_t pair = job / state->num_chunks;
+        const sweep_config_t* config = &state->configs[pair / state->num_traces];
+        const decoded_trace_t* trace = &state->traces[pair % state->num_traces];
+        cache_stats_t* stats = &state->results[job];
+
+        // Split the trace as evenly as possible, so no chunk is empty
+        // unless the whole trace is
+        size_t per_chunk = trace->count / state->num_chunks;
+        size_t extra = trace->count % state->num_chunks;
+        size_t start = chunk * per_chunk + (chunk < extra ? chunk : extra);
+        size_t end = start + per_chunk + (chunk < extra ? 1 : 0);
+        size_t warm_start = start > state->warmup ? start - state->warmup : 0;
+
+        memset(stats, 0, sizeof(cache_stats_t));
+        stats->cache_access_time = 3;
+        stats->memory_access_time = 120;
+        if (start == end) {
+            if (state->classes) {
+                memset(&state->classes[job], 0, sizeof(miss_classes_t));
+            }
+            cache_compute_stats(stats);
+            continue;
+        }
+
+        cache_t* cache = cache_create(config->C, config->B, config->S, config->policy);
+        missclass_t* mc = NULL;
+        if (cache && state->classes) {
+            mc = missclass_create(config->C, config->B, config->S);
+            memset(&state->classes[job], 0, sizeof(miss_classes_t));
+        }
+        if (!cache || (state->classes && !mc)) {
+            cache_destroy(cache);
+            __atomic_store_n(&state->failed, 1, __ATOMIC_RELAXED);
+            break;
+        }
+
+        // Warm the cache up on the accesses just before the chunk so it
+        // does not start cold; those accesses belong to the previous chunk
+        cache_stats_t warmup_stats;
+        memset(&warmup_stats, 0, sizeof(cache_stats_t));
+        simulate_range(cache, trace->records, warm_start, start, &warmup_stats, NULL, NULL);
+        simulate_range(cache, trace->records, start, end, stats,
+                       mc, mc ? &state->classes[job] : NULL);
+        missclass_destroy(mc);
+        cache_destroy(cache);
+        cache_compute_stats(stats);
+    }
+    return NULL;
+}
+
+/**
+ * Decodes the traces of the state
+ *
+ * @return 0 on success, -1 on failure
+ */
+static int decode_traces(sweep_state_t* state, const char* const* traces)
+{
+    decoded_trace_t* decoded = calloc(state->num_traces, sizeof(decoded_trace_t));
+    if (!decoded) return -1;
+
+    for (size_t t = 0; t < state->num_traces; t++) {
+        if (decode_trace(&decoded[t], traces[t])) {
+            perror(traces[t]);
+            while (t--) free_trace(&decoded[t]);
+            free(decoded);
+            return -1;
+        }
+    }
+    state->traces = decoded;
+    return 0;
+}
+
+static void free_traces(sweep_state_t* state)
+{
+    decoded_trace_t* decoded = state->traces;
+    for (size_t t = 0; t < state->num_traces; t++) {
+        free_trace(&decoded[t]);
+    }
+    free(decoded);
+    state->traces = NULL;
+}
+
+/**
+ * Runs every job of the state on a pool of worker threads
+ *
+ * @return 0 on success, -1 on failure
+ */
+static int run_workers(sweep_state_t* state, unsigned threads)
+{
+    if (threads == 0) threads = 1;
+    if (threads > state->num_jobs) threads = (unsigned) state->num_jobs;
+
+    pthread_t* workers = calloc(threads, sizeof(pthread_t));
+    unsigned started = 0;
+    if (workers) {
+        while (started < threads
+               && pthread_create(&workers[started], NULL, sweep_worker, state) == 0) {
+            started++;
+        }
+    }
+    if (started == 0) {
+        // No threads could be started, so run the jobs here
+        sweep_worker(state);
+    }
+    for (unsigned i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+
+    if (state->failed) {
+        printf("Out of memory creating a cache for the sweep\n");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Decodes the traces and runs every job of the state
+ */
+static int run_jobs(sweep_state_t* state, const char* const* traces, unsigned threads)
+{
+    if (decode_traces(state, traces)) return -1;
+    int ret = run_workers(state, threads);
+    free_traces(state);
+    return ret;
+}
+
+/**
+ * Simulates every configuration on every trace. Each trace is decoded
+ * once and shared by a pool of worker threads, which each simulate a
+ * whole (configuration, trace) pair on their own cache instance.
+ *
+ * @param configs The configurations to simulate
+ * @param num_configs The number of configurations
+ * @param traces The paths of the traces to simulate
+ * @param num_traces The number of traces
+ * @param threads The number of worker threads to use
+ * @param results Filled with num_configs * num_traces statistics, with
+ *        the result for configuration c and trace t at c * num_traces + t
+ * @param classes If not NULL, filled with the 3C breakdown of each
+ *        result, in the same order
+ * @return 0 on success, -1 on failure
+ */
+int sweep_run(const sweep_config_t* configs, size_t num_configs,
+              const char* const* traces, size_t num_traces,
+              unsigned threads, cache_stats_t* results, miss_classes_t* classes)
+{
+    sweep_state_t state;
+    memset(&state, 0, sizeof(sweep_state_t));
+    state.configs = configs;
+    state.num_traces = num_traces;
+    state.num_chunks = 1;
+    state.num_jobs = num_configs * num_traces;
+    state.results = results;
+    state.classes = classes;
+    return run_jobs(&state, traces, threads);
+}
+
+/**
+ * Simulates one configuration on one trace split into consecutive
+ * chunks that run in parallel, each on a cache of its own. Each chunk
+ * but the first starts from a cache warmed up on the `warmup` accesses
+ * before it, which stands in for the state the previous chunk would
+ * have left behind. The chunks' counters are then added up, so the
+ * result approximates the serial run; with one chunk it is exact.
+ *
+ * @param config The configuration to simulate
+ * @param trace The path of the trace to simulate
+ * @param chunks The number of chunks to split the trace into; lowered to
+ *        the number of accesses if the trace has fewer
+ * @param warmup The number of accesses replayed before each chunk
+ * @param threads The number of worker threads to use
+ * @param result Filled with the merged statistics
+ * @return 0 on success, -1 on failure
+ */
+int sweep_run_chunked(const sweep_config_t* config, const char* trace, size_t* chunks,
+                      uint64_t warmup, unsigned threads, cache_stats_t* result)
+{
+    sweep_state_t state;
+    memset(&state, 0, sizeof(sweep_state_t));
+    state.configs = config;
+    state.num_traces = 1;
+    if (decode_traces(&state, &trace)) return -1;
+
+    // Every chunk needs at least one access, or it only costs a cache
+    // and a warmup
+    if (*chunks > state.traces[0].count) *chunks = state.traces[0].count;
+    if (*chunks == 0) *chunks = 1;
+    cache_stats_t* parts = calloc(*chunks, sizeof(cache_stats_t));
+    if (!parts) {
+        free_traces(&state);
+        return -1;
+    }
+
+    state.num_chunks = *chunks;
+    state.warmup = warmup;
+    state.num_jobs = *chunks;
+    state.results = parts;
+    int ret = run_workers(&state, threads);
+    free_traces(&state);
+    if (ret) {
+        free(parts);
+        return -1;
+    }
+
+    memset(result, 0, sizeof(cache_stats_t));
+    result->cache_access_time = 3;
+    result->memory_access_time = 120;
+    for (size_t i = 0; i < *chunks; i++) {
+        result->accesses += parts[i].accesses;
+        result->reads += parts[i].reads;
+        result->read_misses += parts[i].read_misses;
+        result->writes += parts[i].writes;
+        result->write_misses += parts[i].write_misses;
+        result->misses += parts[i].misses;
+        result->write_backs += parts[i].write_backs;
+    }
+    cache_compute_stats(result);
+    free(parts);
+    return 0;
+}
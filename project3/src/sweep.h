@@ -0,0 +1,25 @@
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include "cachesim.h"
+#include "missclass.h"
+
+/**
+ * One point of a configuration sweep
+ */
+typedef struct sweep_config {
+    uint64_t C;
+    uint64_t B;
+    uint64_t S;
+    enum REPLACEMENT_POLICY policy;
+    char name[64];          // Optional title printed above the results
+} sweep_config_t;
+
+int sweep_load_configs(const char* path, sweep_config_t** configs, size_t* num_configs);
+int sweep_run(const sweep_config_t* configs, size_t num_configs,
+              const char* const* traces, size_t num_traces,
+              unsigned threads, cache_stats_t* results, miss_classes_t* classes);
+int sweep_run_chunked(const sweep_config_t* config, const char* trace, size_t* chunks,
+                      uint64_t warmup, unsigned threads, cache_stats_t* result);
+
+#endif
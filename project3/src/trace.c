@@ -0,0 +1,423 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <zlib.h>
+#include "trace.h"
+
+#define TRUE 1
+#define FALSE 0
+
+// Size of the refill buffer used when the trace cannot be mapped
+#define TRACE_BUFFER_SIZE (1 << 20)
+
+// Number of records buffered by the converter between writes
+#define CONVERT_BATCH 8192
+
+/**
+ * A compression format that is decompressed by a child process
+ */
+typedef struct decompressor {
+    const char* magic;
+    size_t magic_len;
+    const char* command;    // Decompresses stdin to stdout when run with -dcq
+} decompressor_t;
+
+static const decompressor_t decompressors[] = {
+    { "\x28\xb5\x2f\xfd", 4, "zstd" },
+    { "\xfd" "7zXZ\x00", 6, "xz" },
+};
+
+#define GZIP_MAGIC "\x1f\x8b"
+
+/**
+ * Looks at the first bytes of the trace for the binary header and sets
+ * up pos/end to cover the records, or leaves them alone for a text trace
+ *
+ * @return 0 on success, -1 with errno set to EINVAL for a binary trace
+ *         written in another version of the format
+ */
+static int trace_detect_format(trace_t* trace)
+{
+    size_t avail = (size_t) (trace->end - trace->pos);
+    trace_header_t header;
+
+    trace->format = TRACE_TEXT;
+    if (avail < sizeof(header)) return 0;
+
+    memcpy(&header, trace->pos, sizeof(header));
+    if (memcmp(header.magic, TRACE_MAGIC, TRACE_MAGIC_LEN) != 0) {
+        // Same magic but another version: its records would be misread
+        if (memcmp(header.magic, TRACE_MAGIC, TRACE_MAGIC_LEN - 1) == 0) {
+            fprintf(stderr, "Binary trace version %c is not supported; convert the text trace again with -w\n",
+                    header.magic[TRACE_MAGIC_LEN - 1]);
+            errno = EINVAL;
+            return -1;
+        }
+        return 0;
+    }
+
+    trace->format = TRACE_BINARY;
+    trace->pos += sizeof(header);
+    if (trace->mapped) {
+        // Ignore any trailing bytes past the advertised record count
+        size_t records = (size_t) (trace->end - trace->pos) / sizeof(uint64_t);
+        if (header.count < records) records = header.count;
+        trace->end = trace->pos + records * sizeof(uint64_t);
+    }
+    return 0;
+}
+
+/**
+ * Allocates the refill buffer of a trace whose source is already set up
+ * and reads enough of it to detect the format
+ */
+static int trace_start_buffer(trace_t* trace)
+{
+    trace->size = TRACE_BUFFER_SIZE;
+    trace->base = malloc(trace->size);
+    if (!trace->base) return -1;
+
+    trace->pos = trace->end = trace->base;
+    while (!trace->eof && (size_t) (trace->end - trace->pos) < sizeof(trace_header_t)) {
+        trace_refill(trace);
+    }
+    if (trace_detect_format(trace)) {
+        free(trace->base);
+        trace->base = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Sets up a trace that is read through stdio, e.g. from stdin or a pipe
+ *
+ * @param trace The trace to initialize
+ * @param fin The stream to read the trace from
+ * @return 0 on success, -1 on failure with errno set
+ */
+int trace_open_file(trace_t* trace, FILE* fin)
+{
+    memset(trace, 0, sizeof(trace_t));
+    trace->fin = fin;
+    return trace_start_buffer(trace);
+}
+
+/**
+ * Sets up a trace that inflates a gzip file with zlib
+ */
+static int trace_open_gzip(trace_t* trace, int fd)
+{
+    memset(trace, 0, sizeof(trace_t));
+    gzFile gz = gzdopen(fd, "rb");
+    if (!gz) {
+        close(fd);
+        errno = ENOMEM;
+        return -1;
+    }
+    gzbuffer(gz, TRACE_BUFFER_SIZE / 4);
+    trace->gz = gz;
+    if (trace_start_buffer(trace)) {
+        int saved = errno;
+        gzclose(gz);
+        memset(trace, 0, sizeof(trace_t));
+        errno = saved;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Sets up a trace that reads the output of `command -dcq < fd`, so the
+ * file is decompressed in a separate process while it is simulated
+ */
+static int trace_open_pipe(trace_t* trace, int fd, const char* command)
+{
+    int pipefd[2];
+    if (pipe(pipefd)) {
+        close(fd);
+        return -1;
+    }
+
+    pid_t child = fork();
+    if (child == 0) {
+        dup2(fd, STDIN_FILENO);
+        dup2(pipefd[1], STDOUT_FILENO);
+        close(fd);
+        close(pipefd[0]);
+        close(pipefd[1]);
+        execlp(command, command, "-dcq", (char*) NULL);
+        perror(command);
+        _exit(127);
+    }
+    close(fd);
+    close(pipefd[1]);
+    FILE* fin = child > 0 ? fdopen(pipefd[0], "r") : NULL;
+    if (!fin) {
+        int saved = errno;
+        close(pipefd[0]);
+        if (child > 0) waitpid(child, NULL, 0);
+        errno = saved;
+        return -1;
+    }
+
+    // The child is known before the first read so that a decompressor
+    // failing straight away is caught at the end of its output
+    memset(trace, 0, sizeof(trace_t));
+    trace->fin = fin;
+    trace->child = child;
+    if (trace_start_buffer(trace)) {
+        int saved = errno;
+        fclose(fin);
+        if (trace->child > 0) waitpid(child, NULL, 0);
+        memset(trace, 0, sizeof(trace_t));
+        errno = saved;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Opens a trace file, mapping it into memory when possible. The format
+ * (text or binary) and compression (none, gzip, zstd or xz) are
+ * detected from the file contents.
+ *
+ * @param trace The trace to initialize
+ * @param path The path of the trace file
+ * @return 0 on success, -1 on failure with errno set
+ */
+int trace_open(trace_t* trace, const char* path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+
+    // Pipes cannot be peeked at this way, so only files are decompressed
+    char magic[8];
+    ssize_t peeked = pread(fd, magic, sizeof(magic), 0);
+    size_t have = peeked > 0 ? (size_t) peeked : 0;
+    if (have >= 2 && memcmp(magic, GZIP_MAGIC, 2) == 0) {
+        return trace_open_gzip(trace, fd);
+    }
+    for (size_t i = 0; i < sizeof(decompressors) / sizeof(decompressors[0]); i++) {
+        const decompressor_t* d = &decompressors[i];
+        if (have >= d->magic_len && memcmp(magic, d->magic, d->magic_len) == 0) {
+            return trace_open_pipe(trace, fd, d->command);
+        }
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void* map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            close(fd);
+            madvise(map, (size_t) st.st_size, MADV_SEQUENTIAL);
+
+            memset(trace, 0, sizeof(trace_t));
+            trace->base = map;
+            trace->size = (size_t) st.st_size;
+            trace->mapped = TRUE;
+            trace->eof = TRUE;
+            trace->pos = trace->base;
+            trace->end = trace->base + trace->size;
+            if (trace_detect_format(trace)) {
+                munmap(map, (size_t) st.st_size);
+                memset(trace, 0, sizeof(trace_t));
+                return -1;
+            }
+            return 0;
+        }
+    }
+
+    FILE* fin = fdopen(fd, "r");
+    if (!fin) {
+        close(fd);
+        return -1;
+    }
+    if (trace_open_file(trace, fin)) {
+        int saved = errno;
+        fclose(fin);
+        errno = saved;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Ends the run when the trace cannot be read to the end. Stopping early
+ * is the only safe choice: the accesses already simulated are not the
+ * whole trace, so any statistics printed would be wrong.
+ */
+static void trace_fail(const char* reason)
+{
+    fflush(stdout);
+    fprintf(stderr, "Unable to read trace: %s\n", reason);
+    exit(1);
+}
+
+/**
+ * Waits for the decompressor once it has written everything, failing the
+ * run if it did not exit cleanly
+ */
+static void trace_reap(trace_t* trace)
+{
+    int status;
+    pid_t child = trace->child;
+    trace->child = 0;
+    if (waitpid(child, &status, 0) < 0) {
+        trace_fail(strerror(errno));
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        trace_fail("the decompressor failed");
+    }
+}
+
+/**
+ * Moves the unread bytes to the front of the buffer and reads more of
+ * the trace after them. The buffer grows if a single line fills it.
+ *
+ * @return 1 if more bytes were read, 0 at the end of the trace
+ */
+int trace_refill(trace_t* trace)
+{
+    if (trace->mapped || trace->eof) {
+        trace->eof = TRUE;
+        return 0;
+    }
+
+    size_t left = (size_t) (trace->end - trace->pos);
+    if (left == trace->size) {
+        char* grown = realloc(trace->base, trace->size * 2);
+        if (!grown) {
+            trace->eof = TRUE;
+            return 0;
+        }
+        trace->base = grown;
+        trace->size *= 2;
+    } else {
+        memmove(trace->base, trace->pos, left);
+    }
+
+    size_t got;
+    if (trace->gz) {
+        size_t want = trace->size - left < INT_MAX ? trace->size - left : INT_MAX;
+        int inflated = gzread(trace->gz, trace->base + left, (unsigned) want);
+        got = inflated > 0 ? (size_t) inflated : 0;
+        if (inflated <= 0) {
+            // A truncated or corrupt file also ends the data, but with an error set
+            int error;
+            const char* message = gzerror(trace->gz, &error);
+            if (error != Z_OK) trace_fail(error == Z_ERRNO ? strerror(errno) : message);
+        }
+    } else {
+        got = fread(trace->base + left, 1, trace->size - left, trace->fin);
+        if (got == 0 && ferror(trace->fin)) trace_fail(strerror(errno));
+    }
+    trace->pos = trace->base;
+    trace->end = trace->base + left + got;
+    if (got == 0) {
+        trace->eof = TRUE;
+        if (trace->child > 0) trace_reap(trace);
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * Releases the mapping or buffer of a trace, closes its stream and
+ * reaps its decompressor
+ */
+void trace_close(trace_t* trace)
+{
+    if (trace->mapped) {
+        munmap(trace->base, trace->size);
+    } else {
+        free(trace->base);
+    }
+    if (trace->gz) {
+        gzclose(trace->gz);
+    }
+    if (trace->fin && trace->fin != stdin) {
+        fclose(trace->fin);
+    }
+    // A decompressor still running was cut short by closing the pipe, so
+    // its exit status means nothing
+    if (trace->child > 0) {
+        waitpid(trace->child, NULL, 0);
+    }
+    memset(trace, 0, sizeof(trace_t));
+}
+
+/**
+ * Skips over the next accesses of a trace without returning them. A
+ * mapped binary trace just moves its read position; anything else is
+ * read and parsed as usual.
+ *
+ * @param trace The trace
+ * @param n The number of accesses to skip
+ * @return The number of accesses skipped, less than n at the end of the trace
+ */
+uint64_t trace_skip(trace_t* trace, uint64_t n)
+{
+    if (trace->format == TRACE_BINARY && trace->mapped) {
+        uint64_t left = (uint64_t) (trace->end - trace->pos) / sizeof(uint64_t);
+        if (n > left) n = left;
+        trace->pos += n * sizeof(uint64_t);
+        return n;
+    }
+
+    uint64_t skipped = 0;
+    char rw;
+    uint64_t address;
+    while (skipped < n && trace_next(trace, &rw, &address)) skipped++;
+    return skipped;
+}
+
+/**
+ * Writes every remaining access of a trace to a file in the binary
+ * trace format
+ *
+ * @param trace The trace to convert
+ * @param out_path The path of the binary trace to create
+ * @param count Set to the number of accesses written
+ * @return 0 on success, -1 on failure
+ */
+int trace_convert(trace_t* trace, const char* out_path, uint64_t* count)
+{
+    FILE* fout = fopen(out_path, "wb");
+    if (!fout) return -1;
+
+    trace_header_t header;
+    memcpy(header.magic, TRACE_MAGIC, TRACE_MAGIC_LEN);
+    header.count = 0;
+    if (fwrite(&header, sizeof(header), 1, fout) != 1) goto fail;
+
+    uint64_t records[CONVERT_BATCH];
+    size_t n = 0;
+    char rw;
+    uint64_t address;
+    while (trace_next(trace, &rw, &address)) {
+        records[n++] = trace_pack(rw, address);
+        if (n == CONVERT_BATCH) {
+            if (fwrite(records, sizeof(uint64_t), n, fout) != n) goto fail;
+            header.count += n;
+            n = 0;
+        }
+    }
+    if (fwrite(records, sizeof(uint64_t), n, fout) != n) goto fail;
+    header.count += n;
+
+    // Patch in the final record count
+    if (fseek(fout, 0, SEEK_SET) || fwrite(&header, sizeof(header), 1, fout) != 1) goto fail;
+    if (fclose(fout)) return -1;
+
+    *count = header.count;
+    return 0;
+
+fail:
+    fclose(fout);
+    return -1;
+}
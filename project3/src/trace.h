@@ -0,0 +1,153 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+/*
+ * Binary trace format
+ *
+ * A binary trace starts with a trace_header_t whose magic is
+ * TRACE_MAGIC, followed by `count` 64-bit records. Each record packs one
+ * access: bit 63 is set for a write, bit 62 for an instruction fetch
+ * ('i' in text traces), neither for a data read, and the low 62 bits
+ * hold the address. The header and records are in the byte order of the
+ * machine that wrote them, so binary traces are not portable between
+ * little and big endian hosts.
+ */
+#define TRACE_MAGIC "CSIMTRC2"
+#define TRACE_MAGIC_LEN 8
+
+#define TRACE_WRITE_BIT ((uint64_t) 1 << 63)
+#define TRACE_FETCH_BIT ((uint64_t) 1 << 62)
+#define TRACE_ADDR_MASK (TRACE_FETCH_BIT - 1)
+
+typedef struct trace_header {
+    char magic[TRACE_MAGIC_LEN];
+    uint64_t count;         // Number of records following the header
+} trace_header_t;
+
+enum TRACE_FORMAT { TRACE_TEXT = 0, TRACE_BINARY = 1 };
+
+/**
+ * A trace being read. Regular files are mapped with mmap; pipes, stdin
+ * and compressed files are read through a refill buffer instead. Either
+ * way the unread bytes are always [pos, end).
+ *
+ * gzip files are inflated in process with zlib. zstd and xz files are
+ * piped through a child decompressor, which fin then reads from.
+ */
+typedef struct trace {
+    enum TRACE_FORMAT format;
+    FILE* fin;              // Non-NULL when reading through stdio
+    void* gz;               // Non-NULL when reading a gzip file (gzFile)
+    pid_t child;            // Decompressor feeding fin, or 0
+
+    char* base;             // Mapping or refill buffer
+    size_t size;            // Size of the mapping or buffer
+    uint8_t mapped;         // TRUE if base is an mmap of the whole file
+
+    const char* pos;
+    const char* end;
+    uint8_t eof;            // No more bytes can be pulled into the buffer
+} trace_t;
+
+int trace_open(trace_t* trace, const char* path);
+int trace_open_file(trace_t* trace, FILE* fin);
+int trace_refill(trace_t* trace);
+void trace_close(trace_t* trace);
+uint64_t trace_skip(trace_t* trace, uint64_t n);
+
+int trace_convert(trace_t* trace, const char* out_path, uint64_t* count);
+
+/**
+ * Packs an access into a binary trace record
+ */
+static inline uint64_t trace_pack(char rw, uint64_t address)
+{
+    return (address & TRACE_ADDR_MASK)
+        | (rw == 'w' ? TRACE_WRITE_BIT : 0)
+        | (rw == 'i' ? TRACE_FETCH_BIT : 0);
+}
+
+static inline int trace_hex_digit(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+/**
+ * Parses the next "<rw> <hex address>" line out of a text trace. Lines
+ * that do not contain both fields are skipped, which matches what the
+ * old fscanf loop did with them.
+ *
+ * @return 1 if an access was read, 0 at the end of the trace
+ */
+static inline int trace_next_text(trace_t* trace, char* rw, uint64_t* address)
+{
+    for (;;) {
+        const char* p = trace->pos;
+        const char* end = trace->end;
+        const char* eol = memchr(p, '\n', (size_t) (end - p));
+
+        if (!eol) eol = end;
+        if (eol == end && !trace->eof) {
+            // Incomplete line at the end of the buffer
+            trace_refill(trace);
+            continue;
+        }
+        if (p == end) return 0;
+
+        trace->pos = eol < end ? eol + 1 : eol;
+
+        while (p < eol && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+        if (p == eol) continue;
+        char c = *p++;
+        while (p < eol && (*p == ' ' || *p == '\t')) p++;
+        if (eol - p > 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) p += 2;
+
+        uint64_t value = 0;
+        const char* digits = p;
+        int d;
+        while (p < eol && (d = trace_hex_digit(*p)) >= 0) {
+            value = (value << 4) | (uint64_t) d;
+            p++;
+        }
+        if (p == digits) continue;
+
+        *rw = c;
+        *address = value;
+        return 1;
+    }
+}
+
+/**
+ * Reads the next access from a trace of either format
+ *
+ * @return 1 if an access was read, 0 at the end of the trace
+ */
+static inline int trace_next(trace_t* trace, char* rw, uint64_t* address)
+{
+    if (trace->format == TRACE_TEXT) {
+        return trace_next_text(trace, rw, address);
+    }
+
+    while ((size_t) (trace->end - trace->pos) < sizeof(uint64_t)) {
+        if (trace->eof || !trace_refill(trace)) return 0;
+    }
+
+    uint64_t record;
+    memcpy(&record, trace->pos, sizeof(record));
+    trace->pos += sizeof(record);
+
+    *rw = (record & TRACE_WRITE_BIT) ? 'w' : (record & TRACE_FETCH_BIT) ? 'i' : 'r';
+    *address = record & TRACE_ADDR_MASK;
+    return 1;
+}
+
+#endif
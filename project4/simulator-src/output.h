@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+
+#include "types.h"
+
+/* Size of the stdout buffer per-access lines are collected in */
+#define OUTPUT_BUFFER (1 << 20)
+
+/*
+ * Per-access output.
+ *
+ * Access lines are formatted by hand and appended to stdout, which is
+ * given a large buffer, instead of going through printf. Everything else
+ * still uses printf on the same stream, so lines stay in order.
+ */
+
+/* Formats a value in decimal, right aligned to at least width characters,
+   like "%*u"; returns the end of the formatted value */
+static inline char *output_decimal(char *p, uint64_t value, unsigned width) {
+    char digits[20];
+    unsigned n = 0;
+    do {
+        digits[n++] = (char) ('0' + value % 10);
+        value /= 10;
+    } while (value);
+
+    while (width > n) {
+        *p++ = ' ';
+        width--;
+    }
+    while (n) {
+        *p++ = digits[--n];
+    }
+    return p;
+}
+
+/* Formats a value in lowercase hex with at least width digits, like
+   "%0*x"; returns the end of the formatted value */
+static inline char *output_hex(char *p, uint64_t value, unsigned width) {
+    static const char hex[] = "0123456789abcdef";
+    unsigned n = 1;
+    while (n < 16 && value >> (4 * n)) n++;
+    if (n < width) n = width;
+
+    for (unsigned i = n; i-- > 0; ) {
+        p[i] = hex[value & 15];
+        value >>= 4;
+    }
+    return p + n;
+}
+
+/*
+ * Writes the line printed for an access, the same as
+ * "%8u: %3u  r  0x%05" PRIx64 " -> %02hhx\n" for a read and with
+ * "w" and "<-" for a write
+ */
+static inline void output_access(uint32_t step, uint32_t pid, uint8_t write,
+                                 vaddr_t address, uint8_t data) {
+    char line[80];
+    char *p = output_decimal(line, step, 8);
+    *p++ = ':';
+    *p++ = ' ';
+    p = output_decimal(p, pid, 3);
+    memcpy(p, write ? "  w  0x" : "  r  0x", 7);
+    p = output_hex(p + 7, address, 5);
+    memcpy(p, write ? " <- " : " -> ", 4);
+    p = output_hex(p + 4, data, 2);
+    *p++ = '\n';
+    fwrite(line, 1, (size_t) (p - line), stdout);
+}
@@ -4,50 +4,147 @@
 #include "pagesim.h"
 #include "paging.h"
 #include "swap.h"
+#include "swapops.h"
 #include "stats.h"
+#include "tlb.h"
+#include "trace.h"
+#include "output.h"
 
 /* Simulator data structures */
 uint8_t *mem;
 pfn_t PTBR;
 pcb_t *current_process;
 
+/* Memory parameters */
+uint32_t PADDR_LEN = DEFAULT_PADDR_LEN;
+uint32_t VADDR_LEN = DEFAULT_VADDR_LEN;
+uint32_t OFFSET_LEN = DEFAULT_OFFSET_LEN;
+uint32_t PT_LEVELS = DEFAULT_PT_LEVELS;
+uint32_t pt_shift[MAX_PT_LEVELS];
+uint64_t pt_mask[MAX_PT_LEVELS];
+
 /* Internal array of running processes (we only expose current_process
    to the user) */
 static pcb_t *procs;
 
-/* Constants used in parsing the trace file */
-static const char *START = "START";
-static const char *STOP = "STOP";
-
 void print_help_and_exit(void);
 
-int main(int argc, char **argv)
+/*
+ * Parses a numeric command line argument
+ */
+static uint64_t parse_number(const char *arg)
 {
-    /* Allocate some memory! */
-    if (!(mem = calloc(1, MEM_SIZE))) {
+    char *end;
+    uint64_t value = strtoull(arg, &end, 10);
+    if (*end || end == arg) print_help_and_exit();
+    return value;
+}
+
+/*
+ * Checks the memory parameters and works out the page table geometry:
+ * the VPN bits are split as evenly as possible between the levels, the
+ * top levels taking any left over, and every level's table has to fit
+ * in one frame.
+ */
+static void configure_memory(void)
+{
+    if (OFFSET_LEN < MIN_OFFSET_LEN || OFFSET_LEN > MAX_OFFSET_LEN) {
+        printf("The page offset must be %d to %d bits\n", MIN_OFFSET_LEN, MAX_OFFSET_LEN);
+        exit(1);
+    }
+    if (PADDR_LEN <= OFFSET_LEN || PADDR_LEN > MAX_PADDR_LEN) {
+        printf("Physical addresses must be longer than the page offset and at most %d bits\n",
+               MAX_PADDR_LEN);
+        exit(1);
+    }
+    if (VADDR_LEN <= OFFSET_LEN || VADDR_LEN > MAX_VADDR_LEN) {
+        printf("Virtual addresses must be longer than the page offset and at most %d bits\n",
+               MAX_VADDR_LEN);
+        exit(1);
+    }
+    if (PT_LEVELS < 1 || PT_LEVELS > MAX_PT_LEVELS) {
+        printf("Page tables must have 1 to %d levels\n", MAX_PT_LEVELS);
+        exit(1);
+    }
+    if (NUM_FRAMES * sizeof(fte_t) > MEM_SIZE / 2) {
+        printf("Physical memory is too small to hold its own frame table\n");
         exit(1);
     }
 
+    uint32_t vpn_bits = VADDR_LEN - OFFSET_LEN;
+    uint32_t table_bits = 63 - (uint32_t) __builtin_clzll(PAGE_SIZE / sizeof(pte_t));
+    uint32_t shift = vpn_bits;
+    for (uint32_t level = 0; level < PT_LEVELS; level++) {
+        uint32_t bits = vpn_bits / PT_LEVELS;
+        if (level < vpn_bits % PT_LEVELS) bits++;
+        if (!bits || bits > table_bits) {
+            printf("A %u bit VPN cannot be split into %u levels of page tables of %u bits each\n",
+                   vpn_bits, PT_LEVELS, table_bits);
+            exit(1);
+        }
+        shift -= bits;
+        pt_shift[level] = shift;
+        pt_mask[level] = ((uint64_t) 1 << bits) - 1;
+    }
+}
+
+int main(int argc, char **argv)
+{
     /* Allocate procs */
     if (!(procs = calloc(MAX_PID, sizeof(pcb_t)))) {
         exit(1);
     }
 
     /* Read command line options */
-    FILE *fin = 0;
+    trace_t trace;
+    uint8_t have_trace = FALSE;
+    uint8_t quiet = FALSE;
+    const char *convert_path = NULL;
+    uint64_t tlb_entries = TLB_DEFAULT_ENTRIES;
+    uint64_t tlb_ways = TLB_DEFAULT_WAYS;
+    const char *swap_path = NULL;
     int opt;
-    while (-1 != (opt = getopt(argc, argv, "i:h:s"))) {
+    while (-1 != (opt = getopt(argc, argv, "i:h:sf:t:a:v:p:o:l:qw:"))) {
         switch (opt) {
         case 'i':
-            fin = fopen(optarg, "r");
-
-            if (!fin) {
+            if (trace_open(&trace, optarg)) {
                 perror("Unable to open trace file");
                 exit(1);
             }
+            have_trace = TRUE;
             break;
         case 's':
-            fin = stdin;
+            if (trace_open_file(&trace, stdin)) {
+                exit(1);
+            }
+            have_trace = TRUE;
+            break;
+        case 'f':
+            swap_path = optarg;
+            break;
+        case 't':
+            tlb_entries = parse_number(optarg);
+            break;
+        case 'a':
+            tlb_ways = parse_number(optarg);
+            break;
+        case 'v':
+            VADDR_LEN = (uint32_t) parse_number(optarg);
+            break;
+        case 'p':
+            PADDR_LEN = (uint32_t) parse_number(optarg);
+            break;
+        case 'o':
+            OFFSET_LEN = (uint32_t) parse_number(optarg);
+            break;
+        case 'l':
+            PT_LEVELS = (uint32_t) parse_number(optarg);
+            break;
+        case 'q':
+            quiet = TRUE;
+            break;
+        case 'w':
+            convert_path = optarg;
             break;
         case 'h':
         default:
@@ -56,74 +153,99 @@ int main(int argc, char **argv)
         }
     }
 
-    if (!fin) print_help_and_exit();
+    if (!have_trace) print_help_and_exit();
+
+    if (convert_path) {
+        uint64_t count = 0;
+        int ret = trace_convert(&trace, convert_path, &count);
+        if (ret < 0) {
+            perror("Unable to write binary trace");
+            exit(1);
+        }
+        if (ret > 0) {
+            printf("Unable to parse trace file: Invalid command encountered after %" PRIu64 " records\n", count);
+            exit(1);
+        }
+        printf("Wrote %" PRIu64 " records to %s\n", count, convert_path);
+        trace_close(&trace);
+        exit(0);
+    }
+
+    /* Allocate some memory! */
+    configure_memory();
+    if (!(mem = calloc(1, MEM_SIZE))) {
+        exit(1);
+    }
+    if (swap_path) swap_use_file(swap_path);
+
+    /* Access lines are collected in a large stdout buffer */
+    setvbuf(stdout, NULL, _IOFBF, OUTPUT_BUFFER);
 
     /* Start the simulation */
-    char rw;
-    uint8_t data;
-    uint32_t address;
-    uint32_t pid;
-    char buf[120];
+    trace_record_t record;
     uint32_t step = 0;
+    int ret;
 
+    tlb_init(tlb_entries, tlb_ways);
     system_init();
 
-    while ((fgets(buf, sizeof(buf), fin))) {
-        /* Check if process is starting */
-        if (!strncmp(buf, START, 5)) {
-            /* Start scanning from the pid digits */
-            int ret = sscanf(buf+6, "%" PRIu32 "\n", &pid);
-            if (ret == 1) {
-                /* Initialize new process */
-                pcb_t *new_proc = &procs[pid];
-                new_proc->pid = pid;
-                proc_init(new_proc);
-                printf("%8u: PID %u started\n", step, pid);
-            } else {
-                printf("Unable to parse trace file: Invalid START command encountered\n");
-                exit(1);
-            }
-        } else if (!strncmp(buf, STOP, 4)) { /* Check if process is stopping */
-            /* Start scanning from the pid digits */
-            int ret = sscanf((buf+5), "%" PRIu32 "\n", &pid);
-            if (ret == 1) {
-                proc_cleanup(&procs[pid]);
-                procs[pid].saved_ptbr = 0;
-                printf("%8u: PID %u stopped\n", step, pid);
-            } else {
-                printf("Unable to parse trace file: Invalid STOP command encountered\n");
-                exit(1);
-            }
+    while ((ret = trace_next(&trace, &record)) > 0) {
+        uint32_t pid = record.pid;
+        if (pid >= MAX_PID) {
+            printf("Unable to parse trace file: PID %u is out of range\n", pid);
+            exit(1);
+        }
+
+        if (record.op == TRACE_START) { /* Check if process is starting */
+            /* Initialize new process */
+            pcb_t *new_proc = &procs[pid];
+            new_proc->pid = pid;
+            proc_init(new_proc);
+            if (!quiet) printf("%8u: PID %u started\n", step, pid);
+        } else if (record.op == TRACE_STOP) { /* Check if process is stopping */
+            proc_cleanup(&procs[pid]);
+            procs[pid].saved_ptbr = 0;
+            if (!quiet) printf("%8u: PID %u stopped\n", step, pid);
         } else { /* Regular access trace */
-            int ret = sscanf(buf, "%u %c %x %hhu\n", &pid, &rw, &address, &data);
-            if (ret == 4) {
-                /* Context switch if need be */
-                if (!current_process || current_process->pid != pid) {
-                    context_switch(&procs[pid]);
-                    current_process = &procs[pid];
-                }
-                uint8_t new_data = mem_access(address, rw, data);
-                /* Print data for trace verification */
-                if (rw == 'r') {
-                    printf("%8u: %3u  r  0x%05x -> %02hhx\n", step, pid, address, new_data);
-                } else {
-                    printf("%8u: %3u  w  0x%05x <- %02hhx\n", step, pid, address, data);
-                }
-
-            } else {
-                printf("Unable to parse trace file: Invalid memory access command encountered\n");
+            vaddr_t address = record.address;
+            if (VADDR_LEN < 64 && address >> VADDR_LEN) {
+                printf("Unable to parse trace file: Address 0x%" PRIx64 " is outside the virtual address space\n", address);
                 exit(1);
             }
+
+            /* Context switch if need be */
+            if (!current_process || current_process->pid != pid) {
+                context_switch(&procs[pid]);
+                current_process = &procs[pid];
+            }
+            uint8_t write = record.op == TRACE_WRITE;
+            uint8_t new_data = mem_access(address, write ? 'w' : 'r', record.data);
+            /* Print data for trace verification */
+            if (!quiet) output_access(step, pid, write, address, new_data);
         }
 
         step++;                 /* Count step number for easy debugging */
     }
-    fclose(fin);
+    if (ret < 0) {
+        if (record.op > TRACE_STOP) {
+            printf("Unable to parse trace file: Unknown record type %u encountered\n", record.op);
+        } else if (record.op == TRACE_START) {
+            printf("Unable to parse trace file: Invalid START command encountered\n");
+        } else if (record.op == TRACE_STOP) {
+            printf("Unable to parse trace file: Invalid STOP command encountered\n");
+        } else {
+            printf("Unable to parse trace file: Invalid memory access command encountered\n");
+        }
+        exit(1);
+    }
+    trace_close(&trace);
 
     /* Cleanup and print statistics */
+    swap_shutdown();
     free(mem);
     free(procs);
     compute_stats();
+    tlb_destroy();
 
     printf("Total Accesses     : %" PRIu64 "\n", stats.accesses);
     printf("Reads              : %" PRIu64 "\n", stats.reads);
@@ -131,12 +253,31 @@ int main(int argc, char **argv)
     printf("Page Faults        : %" PRIu64 "\n", stats.page_faults);
     printf("Writes to disk     : %" PRIu64 "\n", stats.writebacks);
     printf("Average Access Time: %f\n", stats.aat);
+    if (tlb_entries) {
+        printf("TLB Hits           : %" PRIu64 "\n", stats.tlb_hits);
+        printf("TLB Misses         : %" PRIu64 "\n", stats.tlb_misses);
+        printf("TLB Flushes        : %" PRIu64 "\n", stats.tlb_flushes);
+    }
+    if (PT_LEVELS > 1) {
+        printf("Page table frames  : %" PRIu64 " peak\n", stats.pt_frames_peak);
+        printf("Page table reads   : %" PRIu64 "\n", stats.pt_swap_ins);
+        printf("Page table writes  : %" PRIu64 "\n", stats.pt_swap_outs);
+    }
 }
 
 void print_help_and_exit() {
 	printf("./vm-sim [OPTIONS] -i traces/file.trace\n");
-    printf("  -i\t\tReads the trace from the specified path\n");
+    printf("  -i\t\tReads the trace, text or binary, from the specified path\n");
     printf("  -s\t\tReads the trace from standard input\n");
+    printf("  -w\t\tConverts the trace to the binary format in the specified file and exits\n");
+    printf("  -q\t\tQuiet: only prints the statistics, not every access\n");
+    printf("  -f\t\tKeeps swapped pages in the specified file instead of memory\n");
+    printf("  -t\t\tTLB entries, a power of two, or 0 for no TLB (default %d)\n", TLB_DEFAULT_ENTRIES);
+    printf("  -a\t\tTLB associativity, a power of two (default %d)\n", TLB_DEFAULT_WAYS);
+    printf("  -v\t\tVirtual address bits (default %d)\n", DEFAULT_VADDR_LEN);
+    printf("  -p\t\tPhysical address bits (default %d)\n", DEFAULT_PADDR_LEN);
+    printf("  -o\t\tPage offset bits (default %d)\n", DEFAULT_OFFSET_LEN);
+    printf("  -l\t\tPage table levels (default %d)\n", DEFAULT_PT_LEVELS);
 	printf("  -h\t\tThis helpful output\n");
 	exit(0);
 }
@@ -22,19 +22,45 @@ typedef struct process {
 /*
  * Memory parameters.
  *
- * These will be provided by the user when they run the simulator.
+ * These will be provided by the user when they run the simulator, and
+ * stay fixed once the simulation starts. The defaults are below.
  */
 
-#define PADDR_LEN 16
-#define VADDR_LEN 20
-#define OFFSET_LEN 12
+#define DEFAULT_PADDR_LEN 16
+#define DEFAULT_VADDR_LEN 20
+#define DEFAULT_OFFSET_LEN 12
+#define DEFAULT_PT_LEVELS 1
 
-#define PAGE_SIZE (1 << OFFSET_LEN)
+/* Limits on the parameters */
+#define MAX_PADDR_LEN 32
+#define MAX_VADDR_LEN 64
+#define MIN_OFFSET_LEN 8
+#define MAX_OFFSET_LEN 16
+#define MAX_PT_LEVELS 4
 
-#define MEM_SIZE (1 << PADDR_LEN)
+extern uint32_t PADDR_LEN;
+extern uint32_t VADDR_LEN;
+extern uint32_t OFFSET_LEN;
 
-#define NUM_PAGES (1 << (VADDR_LEN - OFFSET_LEN))
-#define NUM_FRAMES (1 << (PADDR_LEN - OFFSET_LEN))
+#define PAGE_SIZE ((uint64_t) 1 << OFFSET_LEN)
+
+#define MEM_SIZE ((uint64_t) 1 << PADDR_LEN)
+
+#define NUM_FRAMES ((uint64_t) 1 << (PADDR_LEN - OFFSET_LEN))
+
+/*
+ * Page table geometry.
+ *
+ * A virtual page number is translated by a walk through PT_LEVELS levels
+ * of page tables, each one frame in size. Level 0 is the table the PTBR
+ * points to; the entry for a VPN at each level is at index
+ * (vpn >> pt_shift[level]) & pt_mask[level], and at every level but the
+ * last it holds the frame of the next level's table. With one level this
+ * is a flat page table.
+ */
+extern uint32_t PT_LEVELS;
+extern uint32_t pt_shift[MAX_PT_LEVELS];
+extern uint64_t pt_mask[MAX_PT_LEVELS];
 
 /*
  * Global Data Structures
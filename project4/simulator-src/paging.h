@@ -13,12 +13,12 @@
  * stored in the entry - it's the index into the page table!
  */
 typedef struct ptable_entry {
-    uint8_t valid;              /* 1 if the entry is mapped to a valid frame, 0
+    uint32_t valid : 1;         /* 1 if the entry is mapped to a valid frame, 0
                                    otherwise */
-    uint8_t dirty;              /* 1 if the entry has been modified from its
+    uint32_t dirty : 1;         /* 1 if the entry has been modified from its
                                    form on disk and must be written back when it
                                    is next evicted. */
-    pfn_t pfn;                 /* The physical frame number (PFN) this entry
+    uint32_t pfn : 30;          /* The physical frame number (PFN) this entry
                                    maps to. */
     swap_entry_t swap;          /* The swap entry mapped to this page. Use this
                                    to read to/write from the page to disk using
@@ -42,8 +42,20 @@ typedef struct ptable_entry {
  */
 typedef struct ft_entry {
     /* -- Used for page table pages -- */
-    uint8_t protected;          /* 1 if the frame holds a page table and is
-                                   immune from eviction, 0 otherwise */
+    uint8_t protected;          /* 1 if the frame holds the frame table or a
+                                   page table that is immune from eviction,
+                                   0 otherwise */
+    uint8_t page_table;         /* 1 if the frame holds a page table */
+    uint8_t level;              /* The level of that page table, 0 for the
+                                   top level */
+    uint32_t entries;           /* Entries of the page table in use: valid,
+                                   or holding a swapped-out page or table */
+    uint32_t resident;          /* Entries of the page table that are valid.
+                                   Lower level tables are only protected
+                                   while this is non-zero. */
+    uint8_t dirty;              /* 1 if the swap entries in the page table
+                                   changed since it was read from swap, so
+                                   its copy there is out of date */
     /* -- Used for data pages -- */
     uint8_t mapped;             /* 1 if the frame is mapped, 0
                                    otherwise */
@@ -72,4 +84,27 @@ void proc_cleanup(pcb_t *proc);
 uint8_t mem_access(vaddr_t address, char write, uint8_t data);
 
 pfn_t free_frame(void);
+
+/* Free-frame tracking in page_replacement.c. frames_init sets it up from
+   the frame table; call frame_update after changing a frame's mapped or
+   protected bit. */
+void frames_init(void);
+void frame_update(pfn_t pfn);
+
+/* Multi-level page table walks in paging.c. pt_lookup finds the last
+   level entry for a VPN, or NULL if a table on the way is missing or
+   swapped out; pt_populate allocates or swaps in the tables on the way
+   and counts the entry as in use and resident. pt_release must be called
+   when a page is evicted, and frees tables left empty.
+
+   Lower level tables with no resident entries are not protected, so the
+   clock may pick them; free_frame hands those to pt_evict, which writes
+   the table to swap through its parent's entry unless the copy already
+   there is current. pt_dirty must be called when an entry is given a
+   swap entry or loses one. */
+pte_t *pt_lookup(pfn_t root, vpn_t vpn);
+pte_t *pt_populate(pcb_t *proc, vpn_t vpn);
+void pt_release(pcb_t *proc, vpn_t vpn);
+void pt_evict(pfn_t frame);
+void pt_dirty(pte_t *entry);
 void page_fault(vaddr_t address);
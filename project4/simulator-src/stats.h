@@ -19,6 +19,18 @@ typedef struct stats_t {
 	uint64_t page_faults;
     /* Writebacks to disk */
 	uint64_t writebacks;
+	/* TLB lookups that found or missed a translation, and address
+	   spaces flushed from the TLB */
+	uint64_t tlb_hits;
+	uint64_t tlb_misses;
+	uint64_t tlb_flushes;
+	/* Frames holding page tables now, and at most at any one time */
+	uint64_t pt_frames;
+	uint64_t pt_frames_peak;
+	/* Page tables read back from swap by a page table walk, and written
+	   out to it; these are not counted in page_faults or writebacks */
+	uint64_t pt_swap_ins;
+	uint64_t pt_swap_outs;
 	/* Average Access Time */
 	double aat;
 } stats_t;
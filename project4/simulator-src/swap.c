@@ -1,68 +1,383 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
 #include "swap.h"
 #include "util.h"
 
-static uint64_t TOKEN = 1;
+#ifndef IOV_MAX
+#define IOV_MAX 16              /* The POSIX minimum */
+#endif
 
-swap_info_t *create_entry(void)
+static swap_info_t *slot_info(swap_store_t *store, uint64_t slot)
 {
-    swap_info_t *new_info = calloc(1, sizeof(swap_info_t));
-    if (!new_info) {
-        panic("could not allocate swap entry");
-    }
-    new_info->token = TOKEN++;
-    return new_info;
+    return &store->slabs[slot / SWAP_SLAB_SLOTS][slot % SWAP_SLAB_SLOTS];
 }
 
-void swap_queue_enqueue(swap_queue_t *queue, swap_info_t* info)
+static uint64_t slot_of(const swap_info_t *info)
 {
-    info->next = NULL;
-    if (queue->head == NULL) {
-        queue->head = queue->tail = info;
+    return (info->token & SWAP_SLOT_MASK) - 1;
+}
+
+/*
+ * Hands out a slot with a fresh token, reusing a freed slot if there is
+ * one and adding a slab otherwise. The page data is not cleared.
+ */
+swap_info_t *swap_store_alloc(swap_store_t *store)
+{
+    uint64_t slot;
+    if (store->free_head) {
+        slot = store->free_head - 1;
+        store->free_head = slot_info(store, slot)->next_free;
     } else {
-        queue->tail->next = info;
-        queue->tail = info;
+        if (store->num_slots == SWAP_SLOT_MASK) {
+            panic("swap space exhausted");
+        }
+        if (store->num_slots == store->num_slabs * SWAP_SLAB_SLOTS) {
+            if (store->num_slabs == store->max_slabs) {
+                uint64_t max_slabs = store->max_slabs ? 2 * store->max_slabs : 16;
+                swap_info_t **slabs = realloc(store->slabs, max_slabs * sizeof(swap_info_t *));
+                uint8_t **pages = slabs ? realloc(store->pages, max_slabs * sizeof(uint8_t *)) : NULL;
+                if (slabs) store->slabs = slabs;
+                if (!pages) {
+                    panic("could not allocate swap entry");
+                }
+                store->pages = pages;
+                store->max_slabs = max_slabs;
+            }
+            swap_info_t *slab = calloc(SWAP_SLAB_SLOTS, sizeof(swap_info_t));
+            uint8_t *pages = NULL;
+            if (!store->file_backed) {
+                pages = malloc(SWAP_SLAB_SLOTS * (size_t) PAGE_SIZE);
+            }
+            if (!slab || (!store->file_backed && !pages)) {
+                panic("could not allocate swap entry");
+            }
+            store->slabs[store->num_slabs] = slab;
+            store->pages[store->num_slabs] = pages;
+            store->num_slabs++;
+        }
+        slot = store->num_slots++;
+    }
+
+    /* pending is left alone: a freed slot's data may still be queued for
+       writeback, and the next write to the slot must replace it there */
+    swap_info_t *info = slot_info(store, slot);
+    info->generation++;
+    info->next_free = 0;
+    info->token = (info->generation << SWAP_SLOT_BITS) | (swap_entry_t) (slot + 1);
+    store->size++;
+    return info;
+}
+
+/*
+ * Looks up the slot of a token
+ *
+ * Returns NULL if the token was never handed out or its slot has been
+ * freed since.
+ */
+swap_info_t *swap_store_find(swap_store_t *store, swap_entry_t token)
+{
+    uint64_t slot = (uint64_t) (token & SWAP_SLOT_MASK) - 1;
+    if (!token || slot >= store->num_slots) {
+        return NULL;
     }
-    queue->size++;
+    swap_info_t *info = slot_info(store, slot);
+    return info->token == token ? info : NULL;
+}
+
+/*
+ * Puts a slot on the free list for swap_store_alloc to reuse
+ */
+void swap_store_free(swap_store_t *store, swap_info_t *info)
+{
+    info->next_free = store->free_head;
+    store->free_head = (uint32_t) (slot_of(info) + 1);
+    info->token = 0;
+    store->size--;
 }
 
+/* -------------------------------- File backend -------------------------------- */
+
+typedef struct batch_order {
+    uint32_t slot;
+    uint32_t index;
+} batch_order_t;
 
-void swap_queue_dequeue(swap_queue_t *queue, uint64_t token)
+static int compare_slots(const void *a, const void *b)
 {
-    swap_info_t *curr = queue->head;
-    swap_info_t *prev = NULL;
-
-    while (curr) {
-        if (curr->token == token) {
-            if (prev) {
-                prev->next = curr->next;
-            } else {
-                queue->head = curr->next;
-            }
-            if (curr == queue->tail) {
-                queue->tail = prev;
-            }
-            break;
+    uint32_t x = ((const batch_order_t *) a)->slot;
+    uint32_t y = ((const batch_order_t *) b)->slot;
+    return (x > y) - (x < y);
+}
+
+/*
+ * Writes a run of pages to consecutive slots with as few system calls as
+ * the kernel allows
+ */
+static int write_run(int fd, struct iovec *iov, int count, off_t offset)
+{
+    while (count > 0) {
+        ssize_t written = pwritev(fd, iov, count < IOV_MAX ? count : IOV_MAX, offset);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return errno;
+        }
+        offset += written;
+        while (count > 0 && (size_t) written >= iov->iov_len) {
+            written -= (ssize_t) iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (uint8_t *) iov->iov_base + written;
+            iov->iov_len -= (size_t) written;
         }
-        prev = curr;
-        curr = curr->next;
     }
-    queue->size--;
-    curr->next = NULL;
-    free(curr);
+    return 0;
+}
+
+/*
+ * Writes a batch to the swap file, coalescing pages bound for adjacent
+ * slots into single writes
+ */
+static int write_batch(int fd, swap_batch_t *batch)
+{
+    batch_order_t order[SWAP_WRITEBACK_PAGES];
+    struct iovec iov[SWAP_WRITEBACK_PAGES];
+
+    for (uint32_t i = 0; i < batch->count; i++) {
+        order[i].slot = batch->slots[i];
+        order[i].index = i;
+    }
+    qsort(order, batch->count, sizeof(batch_order_t), compare_slots);
+
+    for (uint64_t start = 0; start < batch->count; ) {
+        uint64_t end = start;
+        do {
+            iov[end - start].iov_base = batch->pages + order[end].index * PAGE_SIZE;
+            iov[end - start].iov_len = PAGE_SIZE;
+            end++;
+        } while (end < batch->count && order[end].slot == order[end - 1].slot + 1);
+
+        int error = write_run(fd, iov, (int) (end - start),
+                              (off_t) order[start].slot * PAGE_SIZE);
+        if (error) return error;
+        start = end;
+    }
+    return 0;
 }
 
-swap_info_t *swap_queue_find(swap_queue_t *queue, uint64_t token)
+/*
+ * Writer thread: writes out each batch handed over by submit_batch until
+ * swap_store_close stops it
+ */
+static void *swap_writer(void *arg)
 {
-    swap_info_t *curr = queue->head;
+    swap_store_t *store = arg;
 
-    while (curr) {
-        if (curr->token == token) {
-            return curr;
+    pthread_mutex_lock(&store->lock);
+    for (;;) {
+        while (!store->busy && !store->stop) {
+            pthread_cond_wait(&store->work, &store->lock);
         }
-        curr = curr->next;
+        if (!store->busy) break;
+
+        swap_batch_t *batch = &store->batches[1 - store->filling];
+        pthread_mutex_unlock(&store->lock);
+        int error = write_batch(store->fd, batch);
+        pthread_mutex_lock(&store->lock);
+
+        if (error && !store->error) store->error = error;
+        store->busy = FALSE;
+        pthread_cond_signal(&store->idle);
     }
+    pthread_mutex_unlock(&store->lock);
     return NULL;
 }
+
+/*
+ * Waits until the batch that is not being filled has reached the file,
+ * then points its slots back at the file and empties it
+ */
+static void reclaim_batch(swap_store_t *store)
+{
+    if (store->threaded) {
+        pthread_mutex_lock(&store->lock);
+        while (store->busy) {
+            pthread_cond_wait(&store->idle, &store->lock);
+        }
+        pthread_mutex_unlock(&store->lock);
+    }
+    if (store->error) {
+        errno = store->error;
+        perror("Unable to write to the swap file");
+        exit(EXIT_FAILURE);
+    }
+
+    uint64_t other = 1 - store->filling;
+    swap_batch_t *batch = &store->batches[other];
+    for (uint64_t i = 0; i < batch->count; i++) {
+        swap_info_t *info = slot_info(store, batch->slots[i]);
+        if (info->pending == other * SWAP_WRITEBACK_PAGES + i + 1) {
+            info->pending = 0;
+        }
+    }
+    batch->count = 0;
+}
+
+/*
+ * Sends the batch being filled to the writer and starts filling the
+ * other one
+ */
+static void submit_batch(swap_store_t *store)
+{
+    reclaim_batch(store);
+    store->filling = 1 - store->filling;
+
+    if (!store->threaded) {
+        store->error = write_batch(store->fd, &store->batches[1 - store->filling]);
+        return;
+    }
+    pthread_mutex_lock(&store->lock);
+    store->busy = TRUE;
+    pthread_cond_signal(&store->work);
+    pthread_mutex_unlock(&store->lock);
+}
+
+/*
+ * Keeps swapped pages in a file instead of memory. Must be called before
+ * any slot is handed out. The file is created or truncated.
+ *
+ * Returns 0 on success, -1 on failure with errno set
+ */
+int swap_store_open_file(swap_store_t *store, const char *path)
+{
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) return -1;
+
+    store->batches = calloc(2, sizeof(swap_batch_t));
+    uint8_t *pages = malloc(2 * SWAP_WRITEBACK_PAGES * (size_t) PAGE_SIZE);
+    if (!store->batches || !pages) {
+        free(store->batches);
+        free(pages);
+        close(fd);
+        errno = ENOMEM;
+        return -1;
+    }
+    store->batches[0].pages = pages;
+    store->batches[1].pages = pages + SWAP_WRITEBACK_PAGES * PAGE_SIZE;
+    store->fd = fd;
+    store->file_backed = TRUE;
+    store->filling = 0;
+
+    pthread_mutex_init(&store->lock, NULL);
+    pthread_cond_init(&store->work, NULL);
+    pthread_cond_init(&store->idle, NULL);
+    /* Set before the writer starts, which reads the flags next to it */
+    store->threaded = TRUE;
+    if (pthread_create(&store->writer, NULL, swap_writer, store)) {
+        store->threaded = FALSE;
+    }
+    return 0;
+}
+
+/*
+ * Writes out everything still queued and releases the store
+ */
+void swap_store_close(swap_store_t *store)
+{
+    if (store->file_backed) {
+        submit_batch(store);
+        reclaim_batch(store);
+        if (store->threaded) {
+            pthread_mutex_lock(&store->lock);
+            store->stop = TRUE;
+            pthread_cond_signal(&store->work);
+            pthread_mutex_unlock(&store->lock);
+            pthread_join(store->writer, NULL);
+        }
+        pthread_cond_destroy(&store->idle);
+        pthread_cond_destroy(&store->work);
+        pthread_mutex_destroy(&store->lock);
+        close(store->fd);
+        free(store->batches[0].pages);
+        free(store->batches);
+    }
+    for (uint64_t i = 0; i < store->num_slabs; i++) {
+        free(store->slabs[i]);
+        free(store->pages[i]);
+    }
+    free(store->slabs);
+    free(store->pages);
+    memset(store, 0, sizeof(swap_store_t));
+}
+
+/*
+ * Copies a slot's page out of the store
+ */
+void swap_store_read(swap_store_t *store, swap_info_t *info, void *dst)
+{
+    uint64_t slot = slot_of(info);
+
+    if (!store->file_backed) {
+        memcpy(dst, &store->pages[slot / SWAP_SLAB_SLOTS][(slot % SWAP_SLAB_SLOTS) * PAGE_SIZE],
+               PAGE_SIZE);
+        return;
+    }
+    if (info->pending) {
+        /* The batches are only read by the writer, so this is safe even
+           while the page is being written out */
+        uint64_t position = info->pending - 1;
+        memcpy(dst, store->batches[position / SWAP_WRITEBACK_PAGES].pages
+                        + position % SWAP_WRITEBACK_PAGES * PAGE_SIZE, PAGE_SIZE);
+        return;
+    }
+
+    size_t done = 0;
+    while (done < PAGE_SIZE) {
+        ssize_t got = pread(store->fd, (uint8_t *) dst + done, PAGE_SIZE - done,
+                            (off_t) (slot * PAGE_SIZE + done));
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) {
+            panic("unable to read from the swap file");
+        }
+        done += (size_t) got;
+    }
+}
+
+/*
+ * Copies a page into a slot. With a swap file the page is queued for
+ * the writer thread; a page already waiting in the batch being filled
+ * is simply replaced.
+ */
+void swap_store_write(swap_store_t *store, swap_info_t *info, const void *src)
+{
+    uint64_t slot = slot_of(info);
+
+    if (!store->file_backed) {
+        memcpy(&store->pages[slot / SWAP_SLAB_SLOTS][(slot % SWAP_SLAB_SLOTS) * PAGE_SIZE], src,
+               PAGE_SIZE);
+        return;
+    }
+
+    uint64_t position = info->pending - 1;
+    if (info->pending && position / SWAP_WRITEBACK_PAGES == store->filling) {
+        memcpy(store->batches[store->filling].pages + position % SWAP_WRITEBACK_PAGES * PAGE_SIZE,
+               src, PAGE_SIZE);
+        return;
+    }
+
+    if (store->batches[store->filling].count == SWAP_WRITEBACK_PAGES) {
+        submit_batch(store);
+    }
+    swap_batch_t *batch = &store->batches[store->filling];
+    uint64_t index = batch->count++;
+    batch->slots[index] = (uint32_t) slot;
+    memcpy(batch->pages + index * PAGE_SIZE, src, PAGE_SIZE);
+    info->pending = (uint32_t) (store->filling * SWAP_WRITEBACK_PAGES + index + 1);
+}
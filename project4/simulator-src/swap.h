@@ -1,25 +1,96 @@
 #pragma once
 
+#include <pthread.h>
+
 #include "pagesim.h"
 #include "types.h"
 
-typedef uint64_t swap_entry_t;
+/* Swap tokens are 32 bits so that a page table entry fits in 8 bytes */
+typedef uint32_t swap_entry_t;
 
-typedef struct swap_info {
+/* Swap slots per slab. Slabs are allocated as the swap store grows and
+   are never returned; freed slots are reused instead. */
+#define SWAP_SLAB_SLOTS 256
 
-    uint64_t token;
-    uint8_t  page_data[PAGE_SIZE];
+/* Bits of a swap token holding the slot; the rest hold its generation */
+#define SWAP_SLOT_BITS 24
+#define SWAP_SLOT_MASK (((uint32_t) 1 << SWAP_SLOT_BITS) - 1)
 
-    struct swap_info *next;
+/* Pages per writeback batch of a file-backed swap store */
+#define SWAP_WRITEBACK_PAGES 64
+
+/*
+ * A swap slot holding one page.
+ *
+ * The token handed out for a slot is its index plus one in the low
+ * SWAP_SLOT_BITS bits and the low bits of the slot's generation above
+ * them. The generation is bumped every time the slot is reused, so a
+ * stale token does not find the slot's new contents until the
+ * generation wraps around.
+ */
+typedef struct swap_info {
+    swap_entry_t token;         /* 0 while the slot is free */
+    uint32_t generation;
+    uint32_t next_free;         /* Index plus one of the next free slot,
+                                   or 0, while the slot is free */
+    uint32_t pending;           /* File backend: position plus one of the
+                                   slot's newest data in a writeback
+                                   batch, or 0 once it is in the file */
 } swap_info_t;
 
-typedef struct _swap_queue_t {
-    swap_info_t *head;
-    swap_info_t *tail;
-    uint64_t size;
-} swap_queue_t;
+/*
+ * A batch of pages on their way to the swap file. The slots are in no
+ * particular order; the writer sorts them to coalesce adjacent ones.
+ */
+typedef struct swap_batch {
+    uint64_t count;
+    uint32_t slots[SWAP_WRITEBACK_PAGES];
+    uint8_t *pages;             /* SWAP_WRITEBACK_PAGES pages of PAGE_SIZE
+                                   bytes */
+} swap_batch_t;
+
+/*
+ * The swap store: every slot ever handed out, indexed directly by the
+ * slot bits of its token, and a list of the free ones.
+ *
+ * Page data either lives in memory, in page slabs parallel to the slot
+ * slabs, or in a swap file at offset slot * PAGE_SIZE. Pages written to
+ * the file go through two writeback batches: one being filled by
+ * evictions while a writer thread writes out the other, so the eviction
+ * path only copies the page. Reads are served from the batches until
+ * the page has reached the file.
+ */
+typedef struct swap_store {
+    swap_info_t **slabs;
+    uint8_t **pages;            /* Memory backend: one page slab per slab */
+    uint64_t num_slabs;
+    uint64_t max_slabs;         /* Capacity of the slabs and pages arrays */
+    uint64_t num_slots;         /* Slots handed out at least once */
+    uint32_t free_head;         /* Index plus one of the first free slot,
+                                   or 0 */
+    uint64_t size;              /* Slots in use */
+
+    /* File backend */
+    uint8_t file_backed;
+    int fd;
+    swap_batch_t *batches;      /* Two batches */
+    uint64_t filling;           /* The batch evictions are copied into */
+    int error;                  /* errno of the first failed write, or 0 */
+
+    uint8_t threaded;
+    uint8_t busy;               /* The writer owns the other batch */
+    uint8_t stop;
+    pthread_t writer;
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t idle;
+} swap_store_t;
+
+int swap_store_open_file(swap_store_t *store, const char *path);
+void swap_store_close(swap_store_t *store);
 
-swap_info_t *create_entry(void);
-void swap_queue_enqueue(swap_queue_t *queue, swap_info_t* info);
-void swap_queue_dequeue(swap_queue_t *queue, uint64_t token);
-swap_info_t *swap_queue_find(swap_queue_t *queue, uint64_t token);
+swap_info_t *swap_store_alloc(swap_store_t *store);
+swap_info_t *swap_store_find(swap_store_t *store, swap_entry_t token);
+void swap_store_free(swap_store_t *store, swap_info_t *info);
+void swap_store_read(swap_store_t *store, swap_info_t *info, void *dst);
+void swap_store_write(swap_store_t *store, swap_info_t *info, const void *src);
@@ -1,33 +1,43 @@
 #include "swapops.h"
 #include "util.h"
 
-static swap_queue_t swap_queue;
+static swap_store_t swap_store;
 
 void swap_read(pte_t *pte, void *dst) {
 
-    swap_info_t *info = swap_queue_find(&swap_queue, pte->swap);
+    swap_info_t *info = swap_store_find(&swap_store, pte->swap);
     if (!info) {
         panic("Attempted to read an invalid swap entry.\nHINT: How do you check if a swap entry exists, and if it does not, what should you put in memory instead?");
     }
-    memcpy(dst, info->page_data, PAGE_SIZE);
+    swap_store_read(&swap_store, info, dst);
 }
 
 void swap_write(pte_t *pte, void *src) {
 
-    swap_info_t *info = swap_queue_find(&swap_queue, pte->swap);
+    swap_info_t *info = swap_store_find(&swap_store, pte->swap);
     if (!info) {
-        info = create_entry(); // creates a swap entry and assigns a token
-        swap_queue_enqueue(&swap_queue, info);
+        info = swap_store_alloc(&swap_store); // takes a slot and assigns a token
         pte->swap = info->token;
     }
-    memcpy(info->page_data, src, PAGE_SIZE);
+    swap_store_write(&swap_store, info, src);
 }
 
 void swap_free(pte_t *pte) {
-    swap_entry_t swp_entry = pte->swap;
-    if (!swap_queue_find(&swap_queue, swp_entry)) {
+    swap_info_t *info = swap_store_find(&swap_store, pte->swap);
+    if (!info) {
         panic("Attempted to free an invalid swap entry!");
     }
-    swap_queue_dequeue(&swap_queue, pte->swap);
+    swap_store_free(&swap_store, info);
     pte->swap = 0;
 }
+
+void swap_use_file(const char *path) {
+    if (swap_store_open_file(&swap_store, path)) {
+        perror("Unable to open swap file");
+        exit(1);
+    }
+}
+
+void swap_shutdown(void) {
+    swap_store_close(&swap_store);
+}
@@ -8,3 +8,9 @@
 void swap_read(pte_t * entry, void *dst);
 void swap_write(pte_t *entry, void * src);
 void swap_free(pte_t * entry);
+
+/* Keep swapped pages in the given file instead of memory; call before
+   the simulation starts */
+void swap_use_file(const char *path);
+/* Flush queued swap writes and free the swap store */
+void swap_shutdown(void);
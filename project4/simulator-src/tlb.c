@@ -0,0 +1,127 @@
+#include "tlb.h"
+#include "stats.h"
+
+static tlb_t tlb;
+
+/*
+ * Sets up the TLB with the given number of entries and ways, both powers
+ * of two. Zero entries leaves the TLB disabled: every lookup misses and
+ * nothing is counted.
+ */
+void tlb_init(uint64_t entries, uint64_t ways) {
+    memset(&tlb, 0, sizeof(tlb_t));
+    if (entries == 0) {
+        return;
+    }
+    if ((entries & (entries - 1)) || !ways || (ways & (ways - 1)) || ways > entries) {
+        printf("The TLB needs a power of two entries and a power of two ways no larger than that\n");
+        exit(1);
+    }
+
+    if (!(tlb.entries = calloc(entries, sizeof(tlb_entry_t)))) {
+        exit(1);
+    }
+    tlb.num_sets = entries / ways;
+    tlb.ways = ways;
+}
+
+void tlb_destroy(void) {
+    free(tlb.entries);
+    memset(&tlb, 0, sizeof(tlb_t));
+}
+
+uint8_t tlb_enabled(void) {
+    return tlb.entries != NULL;
+}
+
+static tlb_entry_t *tlb_set(vpn_t vpn) {
+    return &tlb.entries[(vpn & (tlb.num_sets - 1)) * tlb.ways];
+}
+
+/*
+ * Looks up a translation, counting a hit or a miss
+ *
+ * Returns the entry, or NULL on a miss
+ */
+tlb_entry_t *tlb_lookup(uint32_t asid, vpn_t vpn) {
+    if (!tlb.entries) {
+        return NULL;
+    }
+
+    tlb_entry_t *set = tlb_set(vpn);
+    tlb.clock++;
+    for (uint64_t i = 0; i < tlb.ways; i++) {
+        if (set[i].valid && set[i].vpn == vpn && set[i].asid == asid) {
+            set[i].last_used = tlb.clock;
+            stats.tlb_hits++;
+            return &set[i];
+        }
+    }
+    stats.tlb_misses++;
+    return NULL;
+}
+
+/*
+ * Caches a translation after a miss, replacing an invalid entry of its
+ * set if there is one and the least recently used entry otherwise
+ *
+ * Returns the new entry, or NULL if the TLB is disabled
+ */
+tlb_entry_t *tlb_insert(uint32_t asid, vpn_t vpn, pfn_t pfn, uint8_t dirty) {
+    if (!tlb.entries) {
+        return NULL;
+    }
+
+    tlb_entry_t *set = tlb_set(vpn);
+    tlb_entry_t *victim = &set[0];
+    for (uint64_t i = 0; i < tlb.ways; i++) {
+        if (!set[i].valid) {
+            victim = &set[i];
+            break;
+        }
+        if (set[i].last_used < victim->last_used) {
+            victim = &set[i];
+        }
+    }
+
+    victim->valid = 1;
+    victim->dirty = dirty;
+    victim->asid = asid;
+    victim->vpn = vpn;
+    victim->pfn = pfn;
+    victim->last_used = tlb.clock;
+    return victim;
+}
+
+/*
+ * Drops the translation of one page, e.g. when its frame is evicted
+ */
+void tlb_invalidate(uint32_t asid, vpn_t vpn) {
+    if (!tlb.entries) {
+        return;
+    }
+
+    tlb_entry_t *set = tlb_set(vpn);
+    for (uint64_t i = 0; i < tlb.ways; i++) {
+        if (set[i].valid && set[i].vpn == vpn && set[i].asid == asid) {
+            set[i].valid = 0;
+        }
+    }
+}
+
+/*
+ * Drops every translation of an address space, e.g. when its process
+ * exits and the pid may be reused
+ */
+void tlb_flush(uint32_t asid) {
+    if (!tlb.entries) {
+        return;
+    }
+
+    for (uint64_t i = 0; i < tlb.num_sets * tlb.ways; i++) {
+        if (tlb.entries[i].asid == asid) {
+            tlb.entries[i].valid = 0;
+        }
+    }
+    stats.tlb_flushes++;
+}
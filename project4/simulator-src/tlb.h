@@ -0,0 +1,42 @@
+#pragma once
+
+#include "types.h"
+#include "pagesim.h"
+
+/* Default TLB geometry; vm-sim's -t and -a override it */
+#define TLB_DEFAULT_ENTRIES 64
+#define TLB_DEFAULT_WAYS 4
+
+/*
+ * A TLB entry. Entries are tagged with the address space (ASID) they
+ * belong to, the pid of the owning process, so a context switch does
+ * not need to flush the TLB.
+ */
+typedef struct tlb_entry {
+    uint8_t valid;
+    uint8_t dirty;              /* The page table entry is known to be dirty */
+    uint32_t asid;
+    vpn_t vpn;
+    pfn_t pfn;
+    uint64_t last_used;         /* For LRU replacement within a set */
+} tlb_entry_t;
+
+/*
+ * A set-associative TLB. Sets are indexed by the low bits of the VPN and
+ * replaced LRU.
+ */
+typedef struct tlb {
+    tlb_entry_t *entries;       /* num_sets * ways entries, set by set */
+    uint64_t num_sets;
+    uint64_t ways;
+    uint64_t clock;             /* Lookups so far, the LRU timestamp */
+} tlb_t;
+
+void tlb_init(uint64_t entries, uint64_t ways);
+void tlb_destroy(void);
+uint8_t tlb_enabled(void);
+
+tlb_entry_t *tlb_lookup(uint32_t asid, vpn_t vpn);
+tlb_entry_t *tlb_insert(uint32_t asid, vpn_t vpn, pfn_t pfn, uint8_t dirty);
+void tlb_invalidate(uint32_t asid, vpn_t vpn);
+void tlb_flush(uint32_t asid);
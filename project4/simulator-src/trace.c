@@ -0,0 +1,191 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "pagesim.h"
+#include "trace.h"
+#include "util.h"
+
+/* Size of the refill buffer used when the trace cannot be mapped */
+#define TRACE_BUFFER_SIZE (1 << 20)
+
+/* Number of records buffered by the converter between writes */
+#define CONVERT_BATCH 4096
+
+/*
+ * Looks at the first bytes of the trace for the binary header and sets
+ * up pos/end to cover the records, or leaves them alone for a text trace
+ */
+static void trace_detect_format(trace_t *trace) {
+    size_t avail = (size_t) (trace->end - trace->pos);
+    trace_header_t header;
+
+    trace->format = TRACE_TEXT;
+    if (avail < sizeof(header)) return;
+
+    memcpy(&header, trace->pos, sizeof(header));
+    if (memcmp(header.magic, TRACE_MAGIC, TRACE_MAGIC_LEN)) return;
+
+    trace->format = TRACE_BINARY;
+    trace->pos += sizeof(header);
+    if (trace->mapped) {
+        /* Ignore any trailing bytes past the advertised record count */
+        size_t records = (size_t) (trace->end - trace->pos) / sizeof(trace_record_t);
+        if (header.count < records) records = header.count;
+        trace->end = trace->pos + records * sizeof(trace_record_t);
+    }
+}
+
+/*
+ * Sets up a trace that is read through stdio, e.g. from stdin or a pipe
+ *
+ * Returns 0 on success, -1 on failure
+ */
+int trace_open_file(trace_t *trace, FILE *fin) {
+    memset(trace, 0, sizeof(trace_t));
+    trace->fin = fin;
+    trace->size = TRACE_BUFFER_SIZE;
+    trace->base = malloc(trace->size);
+    if (!trace->base) return -1;
+
+    trace->pos = trace->end = trace->base;
+    while (!trace->eof && (size_t) (trace->end - trace->pos) < sizeof(trace_header_t)) {
+        trace_refill(trace);
+    }
+    trace_detect_format(trace);
+    return 0;
+}
+
+/*
+ * Opens a trace file, mapping it into memory when possible. Whether it is
+ * a text or a binary trace is detected from its contents.
+ *
+ * Returns 0 on success, -1 on failure with errno set
+ */
+int trace_open(trace_t *trace, const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+
+    struct stat st;
+    if (!fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            close(fd);
+            madvise(map, (size_t) st.st_size, MADV_SEQUENTIAL);
+
+            memset(trace, 0, sizeof(trace_t));
+            trace->base = map;
+            trace->size = (size_t) st.st_size;
+            trace->mapped = TRUE;
+            trace->eof = TRUE;
+            trace->pos = trace->base;
+            trace->end = trace->base + trace->size;
+            trace_detect_format(trace);
+            return 0;
+        }
+    }
+
+    FILE *fin = fdopen(fd, "r");
+    if (!fin) {
+        close(fd);
+        return -1;
+    }
+    if (trace_open_file(trace, fin)) {
+        fclose(fin);
+        errno = ENOMEM;
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Moves the unread bytes to the front of the buffer and reads more of the
+ * trace after them. The buffer grows if a single line fills it.
+ *
+ * Returns 1 if more bytes were read, 0 at the end of the trace
+ */
+int trace_refill(trace_t *trace) {
+    if (trace->mapped || trace->eof) {
+        trace->eof = TRUE;
+        return 0;
+    }
+
+    size_t left = (size_t) (trace->end - trace->pos);
+    if (left == trace->size) {
+        char *grown = realloc(trace->base, trace->size * 2);
+        if (!grown) {
+            trace->eof = TRUE;
+            return 0;
+        }
+        trace->base = grown;
+        trace->size *= 2;
+    } else {
+        memmove(trace->base, trace->pos, left);
+    }
+
+    size_t got = fread(trace->base + left, 1, trace->size - left, trace->fin);
+    trace->pos = trace->base;
+    trace->end = trace->base + left + got;
+    if (!got) {
+        trace->eof = TRUE;
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * Releases the mapping or buffer of a trace and closes its stream
+ */
+void trace_close(trace_t *trace) {
+    if (trace->mapped) {
+        munmap(trace->base, trace->size);
+    } else {
+        free(trace->base);
+    }
+    if (trace->fin && trace->fin != stdin) {
+        fclose(trace->fin);
+    }
+    memset(trace, 0, sizeof(trace_t));
+}
+
+/*
+ * Writes every remaining record of a trace to a file in the binary trace
+ * format, setting count to the number written
+ *
+ * Returns 0 on success, 1 if the trace has a malformed line, or -1 if the
+ * file could not be written, with errno set
+ */
+int trace_convert(trace_t *trace, const char *out_path, uint64_t *count) {
+    FILE *fout = fopen(out_path, "wb");
+    if (!fout) return -1;
+
+    trace_header_t header;
+    memcpy(header.magic, TRACE_MAGIC, TRACE_MAGIC_LEN);
+    header.count = 0;
+    if (fwrite(&header, sizeof(header), 1, fout) != 1) goto fail;
+
+    trace_record_t records[CONVERT_BATCH];
+    size_t n = 0;
+    int ret;
+    while ((ret = trace_next(trace, &records[n])) > 0) {
+        if (++n == CONVERT_BATCH) {
+            if (fwrite(records, sizeof(trace_record_t), n, fout) != n) goto fail;
+            header.count += n;
+            n = 0;
+        }
+    }
+    if (fwrite(records, sizeof(trace_record_t), n, fout) != n) goto fail;
+    header.count += n;
+    *count = header.count;
+
+    /* Patch in the final record count */
+    if (fseek(fout, 0, SEEK_SET) || fwrite(&header, sizeof(header), 1, fout) != 1) goto fail;
+    if (fclose(fout)) return -1;
+    return ret < 0;
+
+fail:
+    fclose(fout);
+    return -1;
+}
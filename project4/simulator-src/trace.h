@@ -0,0 +1,189 @@
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+
+#include "types.h"
+
+/*
+ * Binary trace format.
+ *
+ * A binary trace starts with a trace_header_t whose magic is TRACE_MAGIC,
+ * followed by `count` trace_record_t, one per line of the equivalent text
+ * trace. Records are stored in the byte order of the machine that wrote
+ * them, so binary traces are not portable between little and big endian
+ * hosts. vm-sim -w converts a text trace to this format.
+ */
+#define TRACE_MAGIC "VMSIMTR1"
+#define TRACE_MAGIC_LEN 8
+
+typedef struct trace_header {
+    char magic[TRACE_MAGIC_LEN];
+    uint64_t count;             /* Number of records following the header */
+} trace_header_t;
+
+/* What a trace record does */
+enum TRACE_OP {
+    TRACE_READ = 0,
+    TRACE_WRITE = 1,
+    TRACE_START = 2,            /* A process starts */
+    TRACE_STOP = 3              /* A process stops */
+};
+
+/*
+ * One event of a trace: a memory access, or a process starting or
+ * stopping. Text traces are parsed into the same records.
+ */
+typedef struct trace_record {
+    vaddr_t address;            /* Accesses only */
+    uint32_t pid;
+    uint8_t op;                 /* One of TRACE_OP */
+    uint8_t data;               /* Byte written, for writes */
+    uint16_t reserved;
+} trace_record_t;
+
+enum TRACE_FORMAT { TRACE_TEXT = 0, TRACE_BINARY = 1 };
+
+/*
+ * A trace being read. Regular files are mapped with mmap; stdin and pipes
+ * are read through a refill buffer instead. Either way the unread bytes
+ * are always [pos, end).
+ */
+typedef struct trace {
+    enum TRACE_FORMAT format;
+    FILE *fin;                  /* Non-NULL when reading through stdio */
+
+    char *base;                 /* Mapping or refill buffer */
+    size_t size;                /* Size of the mapping or buffer */
+    uint8_t mapped;             /* 1 if base is an mmap of the whole file */
+
+    const char *pos;
+    const char *end;
+    uint8_t eof;                /* No more bytes can be pulled into the buffer */
+} trace_t;
+
+int trace_open(trace_t *trace, const char *path);
+int trace_open_file(trace_t *trace, FILE *fin);
+int trace_refill(trace_t *trace);
+void trace_close(trace_t *trace);
+
+int trace_convert(trace_t *trace, const char *out_path, uint64_t *count);
+
+/* Skips spaces and tabs */
+static inline const char *trace_skip_blank(const char *p, const char *eol) {
+    while (p < eol && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+    return p;
+}
+
+/* Parses a decimal number; returns NULL if there are no digits */
+static inline const char *trace_parse_decimal(const char *p, const char *eol, uint64_t *value) {
+    const char *digits = p;
+    uint64_t v = 0;
+    while (p < eol && *p >= '0' && *p <= '9') {
+        v = v * 10 + (uint64_t) (*p - '0');
+        p++;
+    }
+    *value = v;
+    return p == digits ? NULL : p;
+}
+
+/* Parses a hexadecimal number with an optional 0x; returns NULL if there
+   are no digits */
+static inline const char *trace_parse_hex(const char *p, const char *eol, uint64_t *value) {
+    if (eol - p > 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) p += 2;
+
+    const char *digits = p;
+    uint64_t v = 0;
+    for (; p < eol; p++) {
+        char c = *p;
+        uint64_t d;
+        if (c >= '0' && c <= '9') d = (uint64_t) (c - '0');
+        else if (c >= 'a' && c <= 'f') d = (uint64_t) (c - 'a' + 10);
+        else if (c >= 'A' && c <= 'F') d = (uint64_t) (c - 'A' + 10);
+        else break;
+        v = (v << 4) | d;
+    }
+    *value = v;
+    return p == digits ? NULL : p;
+}
+
+/*
+ * Parses one line of a text trace: "START <pid>", "STOP <pid>" or
+ * "<pid> <r|w> <hex address> <data>". Any access that is not a read is a
+ * write, as before.
+ *
+ * Returns 1 on success, or -1 for a malformed line with record->op set to
+ * the kind of line it looked like
+ */
+static inline int trace_parse_line(const char *p, const char *eol, trace_record_t *record) {
+    uint64_t value;
+
+    memset(record, 0, sizeof(trace_record_t));
+    if (eol - p >= 5 && !memcmp(p, "START", 5)) {
+        record->op = TRACE_START;
+        p = trace_parse_decimal(trace_skip_blank(p + 5, eol), eol, &value);
+        if (!p) return -1;
+        record->pid = (uint32_t) value;
+        return 1;
+    }
+    if (eol - p >= 4 && !memcmp(p, "STOP", 4)) {
+        record->op = TRACE_STOP;
+        p = trace_parse_decimal(trace_skip_blank(p + 4, eol), eol, &value);
+        if (!p) return -1;
+        record->pid = (uint32_t) value;
+        return 1;
+    }
+
+    record->op = TRACE_READ;
+    p = trace_parse_decimal(trace_skip_blank(p, eol), eol, &value);
+    if (!p) return -1;
+    record->pid = (uint32_t) value;
+
+    p = trace_skip_blank(p, eol);
+    if (p == eol) return -1;
+    record->op = *p++ == 'r' ? TRACE_READ : TRACE_WRITE;
+
+    p = trace_parse_hex(trace_skip_blank(p, eol), eol, &value);
+    if (!p) return -1;
+    record->address = value;
+
+    p = trace_parse_decimal(trace_skip_blank(p, eol), eol, &value);
+    if (!p) return -1;
+    record->data = (uint8_t) value;
+    return 1;
+}
+
+/*
+ * Reads the next record of a trace of either format
+ *
+ * Returns 1 if a record was read, 0 at the end of the trace, or -1 for a
+ * malformed text line (see trace_parse_line) or a binary record whose op
+ * is not one of TRACE_OP
+ */
+static inline int trace_next(trace_t *trace, trace_record_t *record) {
+    if (trace->format == TRACE_BINARY) {
+        while ((size_t) (trace->end - trace->pos) < sizeof(trace_record_t)) {
+            if (trace->eof || !trace_refill(trace)) return 0;
+        }
+        memcpy(record, trace->pos, sizeof(trace_record_t));
+        trace->pos += sizeof(trace_record_t);
+        return record->op <= TRACE_STOP ? 1 : -1;
+    }
+
+    for (;;) {
+        const char *p = trace->pos;
+        const char *end = trace->end;
+        const char *eol = memchr(p, '\n', (size_t) (end - p));
+
+        if (!eol) eol = end;
+        if (eol == end && !trace->eof) {
+            /* Incomplete line at the end of the buffer */
+            trace_refill(trace);
+            continue;
+        }
+        if (p == end) return 0;
+
+        trace->pos = eol < end ? eol + 1 : eol;
+        return trace_parse_line(p, eol, record);
+    }
+}
@@ -2,17 +2,18 @@
 
 #include <inttypes.h> /* For uintXX_t types */
 
-/* Virtual addresses are 32 bits. */
-typedef uint32_t vaddr_t;
+/* Virtual addresses are up to 64 bits; the width is set at run time. */
+typedef uint64_t vaddr_t;
 
-/* Physical addresses are 16 bits. */
-typedef uint16_t paddr_t;
+/* Physical addresses are up to 32 bits. */
+typedef uint32_t paddr_t;
 
-/* Virtual page numbers can be up to 16 bits. For pedantic reasons. */
-typedef uint16_t vpn_t;
+/* Virtual page numbers are what is left of a virtual address after the
+   page offset. */
+typedef uint64_t vpn_t;
 
-/* Physical frame numbers can be up to 16 bits. For pedantic reasons. */
-typedef uint16_t pfn_t;
+/* Physical frame numbers fit in a physical address. */
+typedef uint32_t pfn_t;
 
 /* This machine is byte addressed, so an unsigned char will suffice. */
 typedef unsigned char word_t;
@@ -29,8 +29,9 @@ void page_fault(vaddr_t address) {
     vpn_t vpn = vaddr_vpn(address);
     //uint16_t offset = vaddr_offset(address);
 
-    pte_t* page_table = (pte_t*) (mem + PTBR * PAGE_SIZE);
-    pte_t* entry = &page_table[vpn];
+    /* Any page tables missing on the way to the entry are allocated
+       now, before the page itself */
+    pte_t* entry = pt_populate(current_process, vpn);
 
     /* It's a page fault, so the entry obviously won't be valid. Grab
        a frame to use by calling free_frame(). */
@@ -42,9 +43,11 @@ void page_fault(vaddr_t address) {
 
     /* Update the frame table. Make sure you set any relevant bits. */
     frame_table[entry -> pfn].mapped = 1;
+    frame_table[entry -> pfn].page_table = 0;
     frame_table[entry -> pfn].referenced = 0;
     frame_table[entry -> pfn].vpn = vpn;
     frame_table[entry -> pfn].process = current_process;
+    frame_update(entry -> pfn);
 
     /* Initialize the page's memory. On a page fault, it is not enough
      * just to allocate a new frame. We must load in the old data from
@@ -3,9 +3,66 @@
 #include "paging.h"
 #include "swapops.h"
 #include "stats.h"
+#include "tlb.h"
 
 pfn_t select_victim_frame(void);
 
+/*
+ * Free-frame tracking.
+ *
+ * A frame is free when it is neither mapped nor protected. Free frames
+ * are kept in a two-level bitmap: bit i of free_frames is set when frame
+ * i is free, and bit w of free_words is set when free_frames[w] has any
+ * bit set, so the lowest free frame is found with two find-first-set
+ * operations however large physical memory is. frame_update must be
+ * called whenever a frame's mapped or protected bit changes.
+ */
+#define FREE_WORDS ((NUM_FRAMES + 63) / 64)
+#define SUMMARY_WORDS ((FREE_WORDS + 63) / 64)
+
+static uint64_t *free_frames;
+static uint64_t *free_words;
+static uint64_t num_free;
+
+/* The clock hand: the next frame the sweep looks at. It persists across
+   calls so that every frame gets its turn, not just the low ones. */
+static pfn_t clock_hand;
+
+void frame_update(pfn_t pfn) {
+    uint64_t word = pfn / 64;
+    uint64_t bit = (uint64_t) 1 << (pfn % 64);
+    uint8_t is_free = !frame_table[pfn].mapped && !frame_table[pfn].protected;
+    uint8_t was_free = (free_frames[word] & bit) != 0;
+
+    if (is_free == was_free) return;
+    if (is_free) {
+        free_frames[word] |= bit;
+        free_words[word / 64] |= (uint64_t) 1 << (word % 64);
+        num_free++;
+    } else {
+        free_frames[word] &= ~bit;
+        if (!free_frames[word]) {
+            free_words[word / 64] &= ~((uint64_t) 1 << (word % 64));
+        }
+        num_free--;
+    }
+}
+
+void frames_init(void) {
+    free(free_frames);
+    free(free_words);
+    free_frames = calloc(FREE_WORDS, sizeof(uint64_t));
+    free_words = calloc(SUMMARY_WORDS, sizeof(uint64_t));
+    if (!free_frames || !free_words) {
+        exit(1);
+    }
+    num_free = 0;
+    clock_hand = 0;
+    for (uint64_t pfn = 0; pfn < NUM_FRAMES; pfn++) {
+        frame_update((pfn_t) pfn);
+    }
+}
+
 /*  --------------------------------- PROBLEM 7 --------------------------------------
     Finds a free physical frame. If none are available, uses a clock sweep
     algorithm to find a used frame for eviction.
@@ -21,35 +78,36 @@ pfn_t select_victim_frame(void);
     ----------------------------------------------------------------------------------
 */
 pfn_t select_victim_frame() {
-    /* See if there are any free frames */
-    for (int i = 0; i < NUM_FRAMES; i++) {
-        if (!frame_table[i].mapped && !frame_table[i].protected) {
-            return i;
-        }
-    }
-
-    /* Implement a clock sweep algorithm here */
-    for (int i = 0; i < NUM_FRAMES; i++) {
-        if (frame_table[i].referenced && !frame_table[i].protected) {
-            frame_table[i].referenced = 0;
-        } else if (!frame_table[i].referenced && !frame_table[i].protected) {
-            return i;
+    /* Hand out the lowest free frame, if there is one */
+    if (num_free) {
+        for (uint64_t s = 0; s < SUMMARY_WORDS; s++) {
+            if (free_words[s]) {
+                uint64_t word = s * 64 + (uint64_t) __builtin_ctzll(free_words[s]);
+                return (pfn_t) (word * 64 + (uint64_t) __builtin_ctzll(free_frames[word]));
+            }
         }
     }
 
     /*
-     * Cycled all the way through and all reference bits were set.
-     * So loop back and return the first entry that is not protected.
+     * Clock sweep from where the last one stopped. The first lap clears
+     * reference bits, so if every frame was referenced the second lap
+     * finds the first unprotected frame after the hand.
      */
-    for (int i = 0; i < NUM_FRAMES; i++) {
-        if (!frame_table[i].protected) {
-            return i;
+    for (uint64_t i = 0; i < 2 * (uint64_t) NUM_FRAMES; i++) {
+        pfn_t pfn = clock_hand;
+        clock_hand = (pfn_t) ((clock_hand + 1) % NUM_FRAMES);
+        if (frame_table[pfn].protected) {
+            continue;
+        }
+        if (!frame_table[pfn].referenced) {
+            return pfn;
         }
+        frame_table[pfn].referenced = 0;
     }
 
     /* If every frame is protected, give up. This should never happen
        on the traces we provide you. */
-    printf("System ran out of memory\n");
+    printf("System ran out of memory: every frame holds the frame table or a page table in use\n");
     exit(1);
 }
 
@@ -81,20 +139,33 @@ pfn_t free_frame(void) {
      * 3) Mark the original page table entry as invalid
      */
 
-    /* If the victim is in use, we must evict it first */
+    /* If the victim is in use, we must evict it first. A page table is
+       only picked once none of its pages are resident, and is swapped out
+       like one. */
     fte_t* fte = &frame_table[victim_pfn];
-    if (fte -> mapped) {
+    if (fte -> page_table) {
+        pt_evict(victim_pfn);
+    } else if (fte -> mapped) {
         pcb_t* proc = fte -> process;
-        pte_t* page_table = (pte_t*) (mem + (proc -> saved_ptbr * PAGE_SIZE));
         vpn_t vpn = fte -> vpn;
-        pte_t* entry = &page_table[vpn];
+        pte_t* entry = pt_lookup(proc -> saved_ptbr, vpn);
 
         if (entry -> dirty) {
             void* frame = mem + (entry -> pfn * PAGE_SIZE);
+            swap_entry_t old = entry -> swap;
             swap_write(entry, frame);
             stats.writebacks++;
+            /* A new swap entry changes the page table itself */
+            if (entry -> swap != old) {
+                pt_dirty(entry);
+            }
         }
         entry -> valid = 0;
+        tlb_invalidate(proc -> pid, vpn);
+
+        /* The page is no longer resident in its page table, which may now
+           be evictable, or empty if the page left nothing in swap */
+        pt_release(proc, vpn);
     }
 
 
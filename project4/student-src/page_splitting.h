@@ -18,10 +18,15 @@
 
 /* Get the virtual page number from a virtual address. */
 static inline vpn_t vaddr_vpn(vaddr_t addr) {
-    return addr / PAGE_SIZE;
+    return addr >> OFFSET_LEN;
 }
 
 /* Get the offset into the page from a virtual address. */
 static inline uint16_t vaddr_offset(vaddr_t addr) {
-    return addr % PAGE_SIZE;
+    return (uint16_t) (addr & (PAGE_SIZE - 1));
+}
+
+/* Get the index of a VPN's entry in its page table at the given level. */
+static inline uint64_t vpn_index(vpn_t vpn, uint32_t level) {
+    return (vpn >> pt_shift[level]) & pt_mask[level];
 }
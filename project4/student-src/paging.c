@@ -2,6 +2,7 @@
 #include "page_splitting.h"
 #include "swapops.h"
 #include "stats.h"
+#include "tlb.h"
 
  /* The frame table pointer. You will set this up in system_init. */
 fte_t *frame_table;
@@ -41,13 +42,17 @@ void system_init(void) {
     memset(mem,0,NUM_FRAMES * sizeof(fte_t));
 
     /*
-	 * 2. Mark the first frame table entry as protected.
+	 * 2. Mark the frame table entries of the frame table as protected.
      *
      * The frame table contains entries for all of physical memory,
 	 * however, there are some frames we never want to evict.
 	 * We mark these special pages as "protected" to indicate this.
+     * With a large physical memory the frame table spans several frames.
      */
-     frame_table[0].protected = 1;
+     for (uint64_t pfn = 0; pfn * PAGE_SIZE < NUM_FRAMES * sizeof(fte_t); pfn++) {
+         frame_table[pfn].protected = 1;
+     }
+     frames_init();
 
 }
 
@@ -65,13 +70,87 @@ void system_init(void) {
 		in the frame_table as protected after we allocate memory for our page table.
 	-----------------------------------------------------------------------------------
 */
+/*
+ * Allocates a zeroed, protected frame for one of a process's page tables
+ * at the given level, covering the given VPN
+ */
+static pfn_t pt_alloc(pcb_t *proc, vpn_t vpn, uint32_t level) {
+    pfn_t frame = free_frame();
+    memset(mem + frame * PAGE_SIZE, 0, PAGE_SIZE);
+
+    frame_table[frame].protected = 1;
+    frame_table[frame].mapped = 1;
+    frame_table[frame].referenced = 0;
+    frame_table[frame].page_table = 1;
+    frame_table[frame].level = (uint8_t) level;
+    frame_table[frame].entries = 0;
+    frame_table[frame].resident = 0;
+    frame_table[frame].dirty = 0;
+    frame_table[frame].process = proc;
+    frame_table[frame].vpn = vpn;
+    frame_update(frame);
+
+    if (++stats.pt_frames > stats.pt_frames_peak) {
+        stats.pt_frames_peak = stats.pt_frames;
+    }
+    return frame;
+}
+
+/*
+ * Returns the frame of a page table to the free frame allocator
+ */
+static void pt_free(pfn_t frame) {
+    frame_table[frame].protected = 0;
+    frame_table[frame].mapped = 0;
+    frame_table[frame].page_table = 0;
+    frame_table[frame].entries = 0;
+    frame_table[frame].resident = 0;
+    frame_update(frame);
+    stats.pt_frames--;
+}
+
+/*
+ * Counts one more valid entry in a page table, protecting it from eviction
+ */
+static void pt_pin(pfn_t table) {
+    if (!frame_table[table].resident++) {
+        frame_table[table].protected = 1;
+        frame_update(table);
+    }
+}
+
+/*
+ * Counts one less valid entry in a page table. A lower level table left
+ * with none may be evicted; the top level table never is.
+ */
+static void pt_unpin(pfn_t table) {
+    if (!--frame_table[table].resident && frame_table[table].level) {
+        frame_table[table].protected = 0;
+        frame_update(table);
+    }
+}
+
+/*
+ * Counts the entries of a page table just read back from swap. None of
+ * them can be valid, so the ones in use are those holding swap entries.
+ */
+static uint32_t pt_count(pfn_t table, uint32_t level) {
+    pte_t *page_table = (pte_t *) (mem + table * PAGE_SIZE);
+    uint32_t count = 0;
+    for (uint64_t i = 0; i <= pt_mask[level]; i++) {
+        count += page_table[i].swap != 0;
+    }
+    return count;
+}
+
 void proc_init(pcb_t *proc) {
 	/*
      * 1. Call the free frame allocator (free_frame) to return a free frame for
      * this process's page table. You should zero-out the memory.
+     *
+     * Only the top level table is allocated here; lower levels are
+     * allocated by pt_populate when the process first faults on them.
      */
-    pfn_t frame = free_frame();
-    memset(mem + frame * PAGE_SIZE, 0, PAGE_SIZE);
 
     /*
      * 2. Update the process's PCB with the frame number
@@ -80,10 +159,145 @@ void proc_init(pcb_t *proc) {
      * Additionally, mark the frame's frame table entry as protected. You do not
      * want your page table to be accidentally evicted.
 	 */
-    proc -> saved_ptbr = frame;
-    frame_table[frame].protected = 1;
-    frame_table[frame].process = proc;
+    proc -> saved_ptbr = pt_alloc(proc, 0, 0);
+}
+
+/*
+ * Walks the page tables from the given top level table to the last level
+ * entry for a VPN
+ *
+ * Returns the entry, or NULL if a table on the way does not exist or has
+ * been swapped out
+ */
+pte_t *pt_lookup(pfn_t root, vpn_t vpn) {
+    pfn_t table = root;
+    for (uint32_t level = 0; level + 1 < PT_LEVELS; level++) {
+        pte_t *entry = (pte_t *) (mem + table * PAGE_SIZE) + vpn_index(vpn, level);
+        if (!entry -> valid) {
+            return NULL;
+        }
+        table = entry -> pfn;
+    }
+    return (pte_t *) (mem + table * PAGE_SIZE) + vpn_index(vpn, PT_LEVELS - 1);
+}
+
+/*
+ * Walks a process's page tables to the last level entry for a VPN,
+ * allocating the tables that do not exist yet and reading back the ones
+ * that were swapped out. The entry is counted as in use and resident by
+ * its table before this returns, so the table stays in memory while the
+ * caller finds a frame for the page.
+ *
+ * Each table is pinned before the frame below it is allocated, so an
+ * eviction made to find that frame can never free or swap out a table on
+ * the path.
+ */
+pte_t *pt_populate(pcb_t *proc, vpn_t vpn) {
+    pfn_t table = proc -> saved_ptbr;
+    for (uint32_t level = 0; level + 1 < PT_LEVELS; level++) {
+        pte_t *entry = (pte_t *) (mem + table * PAGE_SIZE) + vpn_index(vpn, level);
+        if (!entry -> valid) {
+            if (!entry -> swap) {
+                frame_table[table].entries++;
+            }
+            pt_pin(table);
+            pfn_t frame = pt_alloc(proc, vpn, level + 1);
+            if (entry -> swap) {
+                swap_read(entry, mem + frame * PAGE_SIZE);
+                frame_table[frame].entries = pt_count(frame, level + 1);
+                stats.pt_swap_ins++;
+            }
+            entry -> pfn = frame;
+            entry -> valid = 1;
+        }
+        table = entry -> pfn;
+    }
+
+    pte_t *entry = (pte_t *) (mem + table * PAGE_SIZE) + vpn_index(vpn, PT_LEVELS - 1);
+    if (!entry -> valid) {
+        if (!entry -> swap) {
+            frame_table[table].entries++;
+        }
+        pt_pin(table);
+    }
+    return entry;
+}
+
+/*
+ * Stops counting a process's last level entry for a VPN as resident, once
+ * its page has been evicted, and as in use too if the page left nothing in
+ * swap. Every table below the top level that is left empty is freed.
+ */
+void pt_release(pcb_t *proc, vpn_t vpn) {
+    pfn_t tables[MAX_PT_LEVELS];
+    pfn_t table = proc -> saved_ptbr;
+    for (uint32_t level = 0; level < PT_LEVELS; level++) {
+        tables[level] = table;
+        if (level + 1 < PT_LEVELS) {
+            table = ((pte_t *) (mem + table * PAGE_SIZE) + vpn_index(vpn, level)) -> pfn;
+        }
+    }
+
+    pte_t *entry = (pte_t *) (mem + table * PAGE_SIZE) + vpn_index(vpn, PT_LEVELS - 1);
+    uint8_t in_use = entry -> swap != 0;
+    for (uint32_t level = PT_LEVELS - 1; ; level--) {
+        if (!in_use) {
+            frame_table[tables[level]].entries--;
+        }
+        pt_unpin(tables[level]);
+        if (level == 0 || frame_table[tables[level]].entries) {
+            return;
+        }
+
+        /* The table is empty: unlink it and free its frame and any copy
+           of it left in swap */
+        pt_free(tables[level]);
+        entry = (pte_t *) (mem + tables[level - 1] * PAGE_SIZE) + vpn_index(vpn, level - 1);
+        entry -> valid = 0;
+        if (entry -> swap) {
+            swap_free(entry);
+            pt_dirty(entry);
+        }
+    }
+}
+
+/*
+ * Notes that an entry was given a swap entry or lost one, so the copy in
+ * swap of the page table holding it is out of date
+ */
+void pt_dirty(pte_t *entry) {
+    frame_table[(uint64_t) ((uint8_t *) entry - mem) >> OFFSET_LEN].dirty = 1;
+}
 
+/*
+ * Evicts a lower level page table with no resident entries, chosen by the
+ * page replacement algorithm. The table is written to swap through its
+ * parent's entry, and pt_populate reads it back when it is next needed.
+ *
+ * All of an evicted table's entries are invalid, so only their swap
+ * entries matter: a table read back from swap whose swap entries have not
+ * changed since is already current there and is not written again.
+ */
+void pt_evict(pfn_t frame) {
+    fte_t *fte = &frame_table[frame];
+    pfn_t parent = fte -> process -> saved_ptbr;
+    for (uint32_t level = 0; level + 1 < fte -> level; level++) {
+        parent = ((pte_t *) (mem + parent * PAGE_SIZE) + vpn_index(fte -> vpn, level)) -> pfn;
+    }
+    pte_t *entry = (pte_t *) (mem + parent * PAGE_SIZE) + vpn_index(fte -> vpn, fte -> level - 1U);
+
+    if (!entry -> swap || fte -> dirty) {
+        swap_entry_t old = entry -> swap;
+        swap_write(entry, mem + frame * PAGE_SIZE);
+        stats.pt_swap_outs++;
+        if (entry -> swap != old) {
+            pt_dirty(entry);
+        }
+    }
+    entry -> valid = 0;
+    fte -> page_table = 0;
+    stats.pt_frames--;
+    pt_unpin(parent);
 }
 
 /*  --------------------------------- PROBLEM 4 --------------------------------------
@@ -136,16 +350,35 @@ uint8_t mem_access(vaddr_t address, char rw, uint8_t data) {
     vpn_t vpn = vaddr_vpn(address);
     uint16_t offset = vaddr_offset(address);
 
-    pte_t* page_table = (pte_t*) (mem + PTBR * PAGE_SIZE);
-    pte_t* entry = &page_table[vpn];
+    /* Try the TLB first; only walk the page table on a miss. Entries are
+       tagged with the pid, so other processes' translations never match. */
+    tlb_entry_t* cached = tlb_lookup(current_process -> pid, vpn);
+    pfn_t pfn;
+    if (cached) {
+        pfn = cached -> pfn;
+        /* The first write through a clean translation still has to reach
+           the page table entry to set its dirty bit */
+        if (rw != 'r' && !cached -> dirty) {
+            pt_lookup(PTBR, vpn) -> dirty = 1;
+            cached -> dirty = 1;
+        }
+    } else {
+        pte_t* entry = pt_lookup(PTBR, vpn);
 
-	/* If an entry is invalid, just page fault to allocate a page for the page table. */
-    if (entry -> valid == 0) {
-        page_fault(address);
+        /* If an entry is invalid, just page fault to allocate a page for the page table. */
+        if (!entry || entry -> valid == 0) {
+            page_fault(address);
+            entry = pt_lookup(PTBR, vpn);
+        }
+        if (rw != 'r') {
+            entry -> dirty = 1;
+        }
+        pfn = entry -> pfn;
+        tlb_insert(current_process -> pid, vpn, pfn, entry -> dirty);
     }
 
     /* Set the "referenced" bit to reduce the page's likelihood of eviction */
-    frame_table[entry -> pfn].referenced = 1;
+    frame_table[pfn].referenced = 1;
 
     /*
 		The physical address will be constructed like this:
@@ -159,7 +392,7 @@ uint8_t mem_access(vaddr_t address, char rw, uint8_t data) {
 		table entry.
 	*/
 
-    paddr_t physical_address = (entry -> pfn << OFFSET_LEN) | offset;
+    paddr_t physical_address = (paddr_t) (pfn << OFFSET_LEN) | offset;
 
     /* Either read or write the data to the physical address
        depending on 'rw' */
@@ -169,7 +402,6 @@ uint8_t mem_access(vaddr_t address, char rw, uint8_t data) {
         return mem[physical_address];
     } else {
         mem[physical_address] = data;
-        entry -> dirty = 1;
         stats.writes++;
 	}
     return data;
@@ -187,19 +419,61 @@ uint8_t mem_access(vaddr_t address, char rw, uint8_t data) {
 	You must also clear the "protected" bits for the page table itself.
 	-----------------------------------------------------------------------------------
 */
-void proc_cleanup(pcb_t *proc) {
-    /* Look up the process's page table */
-    pte_t* page_table = (pte_t*) (mem + (proc -> saved_ptbr * PAGE_SIZE));
+static void pt_destroy(pfn_t table, uint32_t level);
 
-    /* Iterate the page table and clean up each valid page */
-    for (size_t i = 0; i < NUM_PAGES; i++) {
-        frame_table[page_table[i].pfn].mapped = 0;
-        if (page_table[i].swap && page_table[i].valid) {
+/*
+ * Frees the pages, swap entries and tables below the entries of a page
+ * table at the given level. Only entries in use need cleaning up, so the
+ * scan stops once `remaining` of them have been seen.
+ */
+static void pt_destroy_entries(pte_t* page_table, uint32_t level, uint64_t remaining) {
+    for (uint64_t i = 0; remaining && i <= pt_mask[level]; i++) {
+        if (!page_table[i].valid && !page_table[i].swap) {
+            continue;
+        }
+        remaining--;
+
+        if (level + 1 < PT_LEVELS) {
+            if (page_table[i].valid) {
+                pt_destroy(page_table[i].pfn, level + 1);
+            } else {
+                /* A swapped-out table is read into a scratch buffer
+                   rather than back into memory */
+                pte_t* swapped = malloc(PAGE_SIZE);
+                if (!swapped) {
+                    exit(1);
+                }
+                swap_read(&page_table[i], swapped);
+                pt_destroy_entries(swapped, level + 1, pt_mask[level + 1] + 1);
+                free(swapped);
+            }
+        } else if (page_table[i].valid) {
+            /* Invalid entries may still name a frame that now belongs to
+               someone else */
+            frame_table[page_table[i].pfn].mapped = 0;
+            frame_update(page_table[i].pfn);
+        }
+        if (page_table[i].swap) {
             swap_free(&page_table[i]);
-            page_table[i].valid = 0;
         }
+        page_table[i].valid = 0;
     }
+}
+
+/*
+ * Frees a page table at the given level, the pages and swap entries it
+ * maps and every table below it
+ */
+static void pt_destroy(pfn_t table, uint32_t level) {
+    pt_destroy_entries((pte_t*) (mem + table * PAGE_SIZE), level, frame_table[table].entries);
+    pt_free(table);
+}
+
+void proc_cleanup(pcb_t *proc) {
+    /* Iterate the page tables and clean up each page in use, then free
+       the page tables themselves in the frame table */
+    pt_destroy(proc -> saved_ptbr, 0);
 
-    /* Free the page table itself in the frame table */
-    frame_table[proc -> saved_ptbr].protected = 0;
+    /* The pid may be reused, so forget the process's translations */
+    tlb_flush(proc -> pid);
 }
@@ -1,5 +1,6 @@
 #include "paging.h"
 #include "stats.h"
+#include "tlb.h"
 
 /* The stats. See the definition in stats.h. */
 stats_t stats;
@@ -17,5 +18,8 @@ stats_t stats;
 	-----------------------------------------------------------------------------------
 */
 void compute_stats() {
-    stats.aat = MEMORY_READ_TIME + ((stats.writebacks * DISK_PAGE_WRITE_TIME) + (stats.page_faults * DISK_PAGE_READ_TIME))/(double)stats.accesses;
+    /* Every page table walk costs a memory read per level. With a TLB only
+       its misses walk the page tables; without one every access does. */
+    uint64_t walks = tlb_enabled() ? stats.tlb_misses : stats.accesses;
+    stats.aat = MEMORY_READ_TIME + (((stats.writebacks + stats.pt_swap_outs) * DISK_PAGE_WRITE_TIME) + ((stats.page_faults + stats.pt_swap_ins) * DISK_PAGE_READ_TIME) + (walks * PT_LEVELS * MEMORY_READ_TIME))/(double)stats.accesses;
 }